@@ -1,6 +1,18 @@
 #include "hex.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+/* emscripten without pthreads runs on one thread, the pick table is then
+ * filled on first use without pthread_once() */
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#include <pthread.h>
+#define HEX_PICK_ONCE
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 void cube_round(struct cube_pos *c_pos)
 {
@@ -24,24 +36,39 @@ void cube_round(struct cube_pos *c_pos)
   c_pos->z = rz;
 }
 
-void map_round(struct map_pos *m_pos)
+/* cube_round() on map coordinates without converting to cube ones. cube
+ * x, y and z are m.x + m.y, -m.x and -m.y, rounding is symmetric around
+ * zero, so the signs drop out and the same component is recomputed. */
+static void map_round_xy(float x, float y, int *r_x, int *r_y)
 {
-  struct cube_pos c_pos;
-  map2cube(m_pos, &c_pos);
-  cube_round(&c_pos);
-  cube2map(&c_pos, m_pos);
-}
+  float s = x + y;
+  float rx = roundf(x);
+  float ry = roundf(y);
+  float rs = roundf(s);
 
-void map_to_offset(struct map_pos *m_pos, struct map_pos *o_pos)
-{
-  o_pos->x = m_pos->x + floorf(m_pos->y / 2);
-  o_pos->y = m_pos->y;
+  float x_diff = fabs(rx - x);
+  float y_diff = fabs(ry - y);
+  float s_diff = fabs(rs - s);
+
+  if (s_diff > x_diff && s_diff > y_diff) {
+    *r_x = rx;
+    *r_y = ry;
+  } else if (x_diff > y_diff) {
+    *r_x = rs - ry;
+    *r_y = ry;
+  } else {
+    *r_x = rx;
+    *r_y = rs - rx;
+  }
 }
 
-void offset_to_map(struct map_pos *o_pos, struct map_pos *m_pos)
+void map_round(struct map_pos *m_pos)
 {
-  m_pos->y = o_pos->y;
-  m_pos->x = o_pos->x - floorf(o_pos->y / 2);
+  int x;
+  int y;
+  map_round_xy(m_pos->x, m_pos->y, &x, &y);
+  m_pos->x = x;
+  m_pos->y = y;
 }
 
 void cube2screen(struct cube_pos* c_pos, struct screen_pos *s_pos)
@@ -70,6 +97,787 @@ void map2cube(struct map_pos *m_pos, struct cube_pos *c_pos)
   c_pos->z = -m_pos->y;
 }
 
+/* neighbor offsets in map coordinates, cube_neighbor_i uses the same order */
+const struct map_ipos map_directions[HEX_DIRECTIONS] = {
+  {1, 0}, {0, 1}, {-1, 1}, {-1, 0}, {0, -1}, {1, -1}
+};
+
+/* floor(v / 2) without going through float */
+static int floor_div2(int v)
+{
+  return (v - (v & 1)) / 2;
+}
+
+void map_to_offset_i(struct map_ipos *m_pos, struct map_ipos *o_pos)
+{
+  o_pos->x = m_pos->x + floor_div2(m_pos->y);
+  o_pos->y = m_pos->y;
+}
+
+void offset_to_map_i(struct map_ipos *o_pos, struct map_ipos *m_pos)
+{
+  m_pos->y = o_pos->y;
+  m_pos->x = o_pos->x - floor_div2(o_pos->y);
+}
+
+void cube_round_i(struct cube_pos *c_pos, struct cube_ipos *r_pos)
+{
+  float rx = roundf(c_pos->x);
+  float ry = roundf(c_pos->y);
+  float rz = roundf(c_pos->z);
+
+  float x_diff = fabs(rx - c_pos->x);
+  float y_diff = fabs(ry - c_pos->y);
+  float z_diff = fabs(rz - c_pos->z);
+
+  r_pos->x = rx;
+  r_pos->y = ry;
+  r_pos->z = rz;
+  if (x_diff > y_diff && x_diff > z_diff) {
+    r_pos->x = -r_pos->y - r_pos->z;
+  } else if (y_diff > z_diff) {
+    r_pos->y = -r_pos->x - r_pos->z;
+  } else {
+    r_pos->z = -r_pos->x - r_pos->y;
+  }
+}
+
+void map_round_i(struct map_pos *m_pos, struct map_ipos *r_pos)
+{
+  map_round_xy(m_pos->x, m_pos->y, &r_pos->x, &r_pos->y);
+}
+
+void cube2screen_i(struct cube_ipos *c_pos, struct screen_pos *s_pos)
+{
+  s_pos->x = ((c_pos->x - c_pos->y) * (int)WIDTH) / 2;
+  s_pos->y = ((c_pos->x + c_pos->y) * 3 * (int)HEIGHT) / 4;
+}
+
+void map2screen_i(struct map_ipos *m_pos, struct screen_pos *s_pos)
+{
+  struct cube_ipos c_pos;
+  map2cube_i(m_pos, &c_pos);
+  cube2screen_i(&c_pos, s_pos);
+}
+
+void screen2map_i(struct screen_pos *s_pos, struct map_ipos *m_pos)
+{
+  struct cube_pos c_pos;
+  struct cube_ipos c_ipos;
+  screen2cube(s_pos, &c_pos);
+  cube_round_i(&c_pos, &c_ipos);
+  cube2map_i(&c_ipos, m_pos);
+}
+
+/* the hex grid repeats every WIDTH pixels horizontally and every two rows
+ * (3 * HEIGHT / 2 pixels) vertically, so one table over that rectangle is
+ * enough to pick the cell under any pixel. the table is filled from
+ * screen2map_i and matches it everywhere except on pixels that lie exactly
+ * between two cells, where the float path decides by sign and rounding
+ * noise and the table always picks the same side. */
+#define PICK_W ((int)WIDTH)
+#define PICK_H (3 * (int)HEIGHT / 2)
+
+struct pick_cell {
+  signed char x;
+  signed char y;
+};
+
+static struct pick_cell pick_lut[PICK_H][PICK_W];
+#ifdef HEX_PICK_ONCE
+static pthread_once_t pick_lut_once = PTHREAD_ONCE_INIT;
+#else
+static int pick_lut_ready = 0;
+#endif
+
+static int floor_div(int v, int d)
+{
+  int q = v / d;
+  if (v % d < 0) {
+    --q;
+  }
+  return q;
+}
+
+static void pick_lut_init(void)
+{
+  for (int y = 0; y < PICK_H; ++y) {
+    for (int x = 0; x < PICK_W; ++x) {
+      struct screen_pos s_pos = {x, y};
+      struct map_ipos m_pos;
+      screen2map_i(&s_pos, &m_pos);
+      pick_lut[y][x].x = m_pos.x;
+      pick_lut[y][x].y = m_pos.y;
+    }
+  }
+}
+
+void screen2map_i_lut(struct screen_pos *s_pos, struct map_ipos *m_pos)
+{
+  /* callers may pick from several threads at once */
+#ifdef HEX_PICK_ONCE
+  pthread_once(&pick_lut_once, pick_lut_init);
+#else
+  if (!pick_lut_ready) {
+    pick_lut_init();
+    pick_lut_ready = 1;
+  }
+#endif
+  int tile_x = floor_div(s_pos->x, PICK_W);
+  int tile_y = floor_div(s_pos->y, PICK_H);
+  struct pick_cell *cell =
+    &pick_lut[s_pos->y - tile_y * PICK_H][s_pos->x - tile_x * PICK_W];
+  /* one period right is map (1, 0), one period down is map (-1, 2) */
+  m_pos->x = tile_x - tile_y + cell->x;
+  m_pos->y = 2 * tile_y + cell->y;
+}
+
+/* runtime tile layouts
+ *
+ * all math is done in "local" coordinates: relative to the layout origin
+ * and, for flat layouts, with screen x and y swapped, so a flat layout is
+ * just a transposed pointy one. layouts with the compile time WIDTH and
+ * HEIGHT go straight to the fixed functions above. */
+static void layout_local(struct hex_layout *layout, struct screen_pos *s_pos,
+    struct screen_pos *l_pos)
+{
+  int x = s_pos->x - layout->origin.x;
+  int y = s_pos->y - layout->origin.y;
+  if (layout->orientation == HEX_FLAT) {
+    l_pos->x = y;
+    l_pos->y = x;
+  } else {
+    l_pos->x = x;
+    l_pos->y = y;
+  }
+}
+
+static void layout_screen(struct hex_layout *layout, int x, int y,
+    struct screen_pos *s_pos)
+{
+  if (layout->orientation == HEX_FLAT) {
+    s_pos->x = y + layout->origin.x;
+    s_pos->y = x + layout->origin.y;
+  } else {
+    s_pos->x = x + layout->origin.x;
+    s_pos->y = y + layout->origin.y;
+  }
+}
+
+static int log2_exact(int v)
+{
+  int shift = 0;
+  if (v <= 0 || (v & (v - 1))) {
+    return -1;
+  }
+  while ((1 << shift) < v) {
+    ++shift;
+  }
+  return shift;
+}
+
+static void layout_local2cube(struct hex_layout *layout, struct screen_pos *l_pos,
+    struct cube_pos *c_pos)
+{
+  if (layout->builtin) {
+    screen2cube(l_pos, c_pos);
+    return;
+  }
+  float a = (float)(2 * l_pos->y) * layout->inv_row;
+  float b = (float)l_pos->x * layout->inv_w;
+  c_pos->x = a + b;
+  c_pos->y = a - b;
+  c_pos->z = -c_pos->x - c_pos->y;
+}
+
+void hex_layout_init(struct hex_layout *layout, int width, int height,
+    enum hex_orientation orientation)
+{
+  layout->width = width;
+  layout->height = height;
+  layout->orientation = orientation;
+  layout->origin.x = 0;
+  layout->origin.y = 0;
+  layout->builtin = orientation == HEX_POINTY
+    && width == (int)WIDTH && height == (int)HEIGHT;
+  if (orientation == HEX_FLAT) {
+    layout->local_w = height;
+    layout->local_h = width;
+  } else {
+    layout->local_w = width;
+    layout->local_h = height;
+  }
+  layout->inv_w = 1.0f / layout->local_w;
+  layout->inv_row = 1.0f / (3 * layout->local_h);
+
+  /* screen offsets of map (1, 0) and (0, 1), exact if both are whole pixels */
+  layout->step_exact = layout->local_w % 2 == 0 && layout->local_h % 4 == 0;
+  layout_screen(layout, layout->local_w, 0, &layout->step_x);
+  layout_screen(layout, layout->local_w / 2, 3 * layout->local_h / 4,
+      &layout->step_y);
+
+  /* the grid repeats every local_w pixels sideways (map (1, 0)) and every
+   * two rows downwards (map (-1, 2)), or four rows if a row pair does not
+   * end on a whole pixel */
+  layout->pick_w = layout->local_w;
+  layout->pick_w_shift = log2_exact(layout->local_w);
+  if ((3 * layout->local_h) % 2 == 0) {
+    layout->pick_h = 3 * layout->local_h / 2;
+    layout->pick_rows = 2;
+  } else {
+    layout->pick_h = 3 * layout->local_h;
+    layout->pick_rows = 4;
+  }
+  layout->pick = malloc(2 * layout->pick_w * layout->pick_h);
+  signed char *cell = layout->pick;
+  for (int y = 0; y < layout->pick_h; ++y) {
+    for (int x = 0; x < layout->pick_w; ++x) {
+      struct screen_pos l_pos = {x, y};
+      struct cube_pos c_pos;
+      struct cube_ipos c_ipos;
+      struct map_ipos m_pos;
+      layout_local2cube(layout, &l_pos, &c_pos);
+      cube_round_i(&c_pos, &c_ipos);
+      cube2map_i(&c_ipos, &m_pos);
+      *cell++ = m_pos.x;
+      *cell++ = m_pos.y;
+    }
+  }
+}
+
+void hex_layout_free(struct hex_layout *layout)
+{
+  free(layout->pick);
+  layout->pick = NULL;
+}
+
+void hex_layout_set_origin(struct hex_layout *layout, int x, int y)
+{
+  layout->origin.x = x;
+  layout->origin.y = y;
+}
+
+void hex_layout_cube2screen(struct hex_layout *layout, struct cube_pos *c_pos,
+    struct screen_pos *s_pos)
+{
+  struct screen_pos l_pos;
+  if (layout->builtin) {
+    cube2screen(c_pos, &l_pos);
+  } else {
+    l_pos.x = ((c_pos->x - c_pos->y) * layout->local_w) / 2;
+    l_pos.y = ((c_pos->x + c_pos->y) * 3 * layout->local_h) / 4;
+  }
+  layout_screen(layout, l_pos.x, l_pos.y, s_pos);
+}
+
+void hex_layout_screen2cube(struct hex_layout *layout, struct screen_pos *s_pos,
+    struct cube_pos *c_pos)
+{
+  struct screen_pos l_pos;
+  layout_local(layout, s_pos, &l_pos);
+  layout_local2cube(layout, &l_pos, c_pos);
+}
+
+void hex_layout_map2screen_i(struct hex_layout *layout, struct map_ipos *m_pos,
+    struct screen_pos *s_pos)
+{
+  /* cube x - y = 2 * map x + map y, cube x + y = map y */
+  int x = ((2 * m_pos->x + m_pos->y) * layout->local_w) / 2;
+  int y = (m_pos->y * 3 * layout->local_h) / 4;
+  layout_screen(layout, x, y, s_pos);
+}
+
+void hex_layout_screen2map_i(struct hex_layout *layout, struct screen_pos *s_pos,
+    struct map_ipos *m_pos)
+{
+  struct screen_pos l_pos;
+  int tile_x;
+  int px;
+  layout_local(layout, s_pos, &l_pos);
+  if (layout->pick_w_shift >= 0) {
+    tile_x = l_pos.x >> layout->pick_w_shift;
+    px = l_pos.x & (layout->pick_w - 1);
+  } else {
+    tile_x = floor_div(l_pos.x, layout->pick_w);
+    px = l_pos.x - tile_x * layout->pick_w;
+  }
+  int tile_y = floor_div(l_pos.y, layout->pick_h);
+  int py = l_pos.y - tile_y * layout->pick_h;
+  signed char *cell = layout->pick + 2 * (py * layout->pick_w + px);
+  int rows = layout->pick_rows * tile_y;
+  m_pos->x = tile_x - rows / 2 + cell[0];
+  m_pos->y = rows + cell[1];
+}
+
+/* cell iterators
+ *
+ * screen positions are linear in map coordinates whenever the layout
+ * steps are whole pixels, so the iterators keep the current screen
+ * position and move it along with the cell instead of converting. */
+static void iter_start(struct hex_iter *it, struct hex_layout *layout,
+    int x, int y, int count)
+{
+  it->layout = layout;
+  it->pos.x = x;
+  it->pos.y = y;
+  hex_layout_map2screen_i(layout, &it->pos, &it->screen);
+  it->count = count;
+  it->started = 0;
+  it->side = 0;
+  it->step = 0;
+}
+
+static void iter_move(struct hex_iter *it, int dx, int dy)
+{
+  it->pos.x += dx;
+  it->pos.y += dy;
+  if (it->layout->step_exact) {
+    it->screen.x += dx * it->layout->step_x.x + dy * it->layout->step_y.x;
+    it->screen.y += dx * it->layout->step_x.y + dy * it->layout->step_y.y;
+  } else {
+    hex_layout_map2screen_i(it->layout, &it->pos, &it->screen);
+  }
+}
+
+void hex_iter_ring(struct hex_iter *it, struct hex_layout *layout,
+    struct map_ipos *center, int radius)
+{
+  iter_start(it, layout, center->x + map_directions[4].x * radius,
+      center->y + map_directions[4].y * radius, radius ? 6 * radius : 1);
+  it->type = HEX_ITER_RING;
+  it->radius = radius;
+}
+
+void hex_iter_spiral(struct hex_iter *it, struct hex_layout *layout,
+    struct map_ipos *center, int radius)
+{
+  iter_start(it, layout, center->x, center->y, 1 + 3 * radius * (radius + 1));
+  it->type = HEX_ITER_SPIRAL;
+  it->radius = 0;
+}
+
+void hex_iter_range(struct hex_iter *it, struct hex_layout *layout,
+    struct map_ipos *center, int radius)
+{
+  /* rows from -radius to radius, each row clipped to the hexagon */
+  iter_start(it, layout, center->x, center->y - radius,
+      1 + 3 * radius * (radius + 1));
+  it->type = HEX_ITER_RANGE;
+  it->radius = radius;
+  it->row = -radius;
+  it->center = *center;
+  it->x_end = center->x + radius;
+}
+
+void hex_iter_rect(struct hex_iter *it, struct hex_layout *layout,
+    int x, int y, int w, int h)
+{
+  struct map_ipos o_pos = {x, y};
+  struct map_ipos m_pos;
+  offset_to_map_i(&o_pos, &m_pos);
+  iter_start(it, layout, m_pos.x, m_pos.y, w > 0 && h > 0 ? w * h : 0);
+  it->type = HEX_ITER_RECT;
+  it->x0 = x;
+  it->w = w;
+  it->row = y;
+}
+
+static void iter_advance(struct hex_iter *it)
+{
+  switch (it->type) {
+    case HEX_ITER_RING:
+    case HEX_ITER_SPIRAL:
+      if (it->radius == 0) {
+        /* spiral: step out of the center onto ring 1 */
+        iter_move(it, map_directions[4].x, map_directions[4].y);
+        it->radius = 1;
+        return;
+      }
+      iter_move(it, map_directions[it->side].x, map_directions[it->side].y);
+      if (++it->step == it->radius) {
+        it->step = 0;
+        if (++it->side == HEX_DIRECTIONS) {
+          /* back at the ring start, step out onto the next ring */
+          it->side = 0;
+          iter_move(it, map_directions[4].x, map_directions[4].y);
+          ++it->radius;
+        }
+      }
+      break;
+    case HEX_ITER_RANGE:
+      if (it->pos.x < it->x_end) {
+        iter_move(it, 1, 0);
+      } else {
+        ++it->row;
+        int x_start = it->row < 0 ? -it->row - it->radius : -it->radius;
+        int x_end = it->row < 0 ? it->radius : it->radius - it->row;
+        it->x_end = it->center.x + x_end;
+        iter_move(it, it->center.x + x_start - it->pos.x, 1);
+      }
+      break;
+    case HEX_ITER_RECT:
+      if (it->pos.x + floor_div2(it->pos.y) < it->x0 + it->w - 1) {
+        iter_move(it, 1, 0);
+      } else {
+        ++it->row;
+        iter_move(it, it->x0 - floor_div2(it->row) - it->pos.x, 1);
+      }
+      break;
+  }
+}
+
+int hex_iter_next(struct hex_iter *it)
+{
+  if (it->count <= 0) {
+    return 0;
+  }
+  if (it->started) {
+    iter_advance(it);
+  }
+  it->started = 1;
+  --it->count;
+  return 1;
+}
+
+/* batch versions of screen2map_i and cube_round_i
+ *
+ * the vector kernels do the same float operations in the same order as
+ * screen2cube/cube_round, and emulate roundf (half away from zero) with a
+ * truncate-and-compare, so they give exactly the scalar results for any
+ * input where |coordinate| < 2^23. */
+#if defined(__AVX2__)
+#define HEX_BATCH_WIDTH 8
+
+static __m256i round_avx2(__m256 v)
+{
+  __m256i r = _mm256_cvttps_epi32(v);
+  __m256 f = _mm256_sub_ps(v, _mm256_cvtepi32_ps(r));
+  r = _mm256_sub_epi32(r, _mm256_castps_si256(
+        _mm256_cmp_ps(f, _mm256_set1_ps(0.5f), _CMP_GE_OQ)));
+  return _mm256_add_epi32(r, _mm256_castps_si256(
+        _mm256_cmp_ps(f, _mm256_set1_ps(-0.5f), _CMP_LE_OQ)));
+}
+
+static __m256 round_diff_avx2(__m256i r, __m256 v)
+{
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f),
+      _mm256_sub_ps(_mm256_cvtepi32_ps(r), v));
+}
+
+static void cube_round_avx2(__m256 cx, __m256 cy, __m256 cz,
+    __m256i *x, __m256i *y, __m256i *z)
+{
+  __m256i rx = round_avx2(cx);
+  __m256i ry = round_avx2(cy);
+  __m256i rz = round_avx2(cz);
+  __m256 x_diff = round_diff_avx2(rx, cx);
+  __m256 y_diff = round_diff_avx2(ry, cy);
+  __m256 z_diff = round_diff_avx2(rz, cz);
+  __m256i fix_x = _mm256_castps_si256(_mm256_and_ps(
+        _mm256_cmp_ps(x_diff, y_diff, _CMP_GT_OQ),
+        _mm256_cmp_ps(x_diff, z_diff, _CMP_GT_OQ)));
+  __m256i fix_y = _mm256_andnot_si256(fix_x,
+      _mm256_castps_si256(_mm256_cmp_ps(y_diff, z_diff, _CMP_GT_OQ)));
+  __m256i fix_z = _mm256_andnot_si256(_mm256_or_si256(fix_x, fix_y),
+      _mm256_set1_epi32(-1));
+  __m256i zero = _mm256_setzero_si256();
+  *x = _mm256_blendv_epi8(rx, _mm256_sub_epi32(_mm256_sub_epi32(zero, ry), rz), fix_x);
+  *y = _mm256_blendv_epi8(ry, _mm256_sub_epi32(_mm256_sub_epi32(zero, rx), rz), fix_y);
+  *z = _mm256_blendv_epi8(rz, _mm256_sub_epi32(_mm256_sub_epi32(zero, rx), ry), fix_z);
+}
+
+static void screen2map_avx2(__m256i sx, __m256i sy, struct map_ipos *m_pos)
+{
+  __m256 a = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(sy, sy)),
+      _mm256_set1_ps(3 * HEIGHT));
+  __m256 b = _mm256_div_ps(_mm256_cvtepi32_ps(sx), _mm256_set1_ps(WIDTH));
+  __m256 cx = _mm256_add_ps(a, b);
+  __m256 cy = _mm256_sub_ps(a, b);
+  __m256 cz = _mm256_sub_ps(_mm256_xor_ps(cx, _mm256_set1_ps(-0.0f)), cy);
+
+  __m256i rx, ry, rz;
+  cube_round_avx2(cx, cy, cz, &rx, &ry, &rz);
+  __m256i map_x = _mm256_add_epi32(rx, rz);
+  __m256i map_y = _mm256_sub_epi32(_mm256_setzero_si256(), rz);
+
+  __m256i lo = _mm256_unpacklo_epi32(map_x, map_y);
+  __m256i hi = _mm256_unpackhi_epi32(map_x, map_y);
+  _mm256_storeu_si256((__m256i *)m_pos, _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256((__m256i *)(m_pos + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+#elif defined(__SSE2__)
+#define HEX_BATCH_WIDTH 4
+
+static __m128i select_si128(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static __m128i round_sse2(__m128 v)
+{
+  __m128i r = _mm_cvttps_epi32(v);
+  __m128 f = _mm_sub_ps(v, _mm_cvtepi32_ps(r));
+  r = _mm_sub_epi32(r, _mm_castps_si128(_mm_cmpge_ps(f, _mm_set1_ps(0.5f))));
+  return _mm_add_epi32(r, _mm_castps_si128(_mm_cmple_ps(f, _mm_set1_ps(-0.5f))));
+}
+
+static __m128 round_diff_sse2(__m128i r, __m128 v)
+{
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(_mm_cvtepi32_ps(r), v));
+}
+
+static void cube_round_sse2(__m128 cx, __m128 cy, __m128 cz,
+    __m128i *x, __m128i *y, __m128i *z)
+{
+  __m128i rx = round_sse2(cx);
+  __m128i ry = round_sse2(cy);
+  __m128i rz = round_sse2(cz);
+  __m128 x_diff = round_diff_sse2(rx, cx);
+  __m128 y_diff = round_diff_sse2(ry, cy);
+  __m128 z_diff = round_diff_sse2(rz, cz);
+  __m128i fix_x = _mm_castps_si128(_mm_and_ps(
+        _mm_cmpgt_ps(x_diff, y_diff), _mm_cmpgt_ps(x_diff, z_diff)));
+  __m128i fix_y = _mm_andnot_si128(fix_x,
+      _mm_castps_si128(_mm_cmpgt_ps(y_diff, z_diff)));
+  __m128i fix_z = _mm_andnot_si128(_mm_or_si128(fix_x, fix_y),
+      _mm_set1_epi32(-1));
+  __m128i zero = _mm_setzero_si128();
+  *x = select_si128(fix_x, _mm_sub_epi32(_mm_sub_epi32(zero, ry), rz), rx);
+  *y = select_si128(fix_y, _mm_sub_epi32(_mm_sub_epi32(zero, rx), rz), ry);
+  *z = select_si128(fix_z, _mm_sub_epi32(_mm_sub_epi32(zero, rx), ry), rz);
+}
+
+static void screen2map_sse2(__m128i sx, __m128i sy, struct map_ipos *m_pos)
+{
+  __m128 a = _mm_div_ps(_mm_cvtepi32_ps(_mm_add_epi32(sy, sy)),
+      _mm_set1_ps(3 * HEIGHT));
+  __m128 b = _mm_div_ps(_mm_cvtepi32_ps(sx), _mm_set1_ps(WIDTH));
+  __m128 cx = _mm_add_ps(a, b);
+  __m128 cy = _mm_sub_ps(a, b);
+  __m128 cz = _mm_sub_ps(_mm_xor_ps(cx, _mm_set1_ps(-0.0f)), cy);
+
+  __m128i rx, ry, rz;
+  cube_round_sse2(cx, cy, cz, &rx, &ry, &rz);
+  __m128i map_x = _mm_add_epi32(rx, rz);
+  __m128i map_y = _mm_sub_epi32(_mm_setzero_si128(), rz);
+
+  _mm_storeu_si128((__m128i *)m_pos, _mm_unpacklo_epi32(map_x, map_y));
+  _mm_storeu_si128((__m128i *)(m_pos + 2), _mm_unpackhi_epi32(map_x, map_y));
+}
+#endif
+
+void cube_round_i_batch(struct cube_pos *c_pos, struct cube_ipos *r_pos, int n)
+{
+  int i = 0;
+#if defined(HEX_BATCH_WIDTH)
+  int rx[HEX_BATCH_WIDTH];
+  int ry[HEX_BATCH_WIDTH];
+  int rz[HEX_BATCH_WIDTH];
+  for (; i + HEX_BATCH_WIDTH <= n; i += HEX_BATCH_WIDTH) {
+    struct cube_pos *c = c_pos + i;
+#if defined(__AVX2__)
+    __m256i x, y, z;
+    cube_round_avx2(
+        _mm256_setr_ps(c[0].x, c[1].x, c[2].x, c[3].x, c[4].x, c[5].x, c[6].x, c[7].x),
+        _mm256_setr_ps(c[0].y, c[1].y, c[2].y, c[3].y, c[4].y, c[5].y, c[6].y, c[7].y),
+        _mm256_setr_ps(c[0].z, c[1].z, c[2].z, c[3].z, c[4].z, c[5].z, c[6].z, c[7].z),
+        &x, &y, &z);
+    _mm256_storeu_si256((__m256i *)rx, x);
+    _mm256_storeu_si256((__m256i *)ry, y);
+    _mm256_storeu_si256((__m256i *)rz, z);
+#else
+    __m128i x, y, z;
+    cube_round_sse2(
+        _mm_setr_ps(c[0].x, c[1].x, c[2].x, c[3].x),
+        _mm_setr_ps(c[0].y, c[1].y, c[2].y, c[3].y),
+        _mm_setr_ps(c[0].z, c[1].z, c[2].z, c[3].z),
+        &x, &y, &z);
+    _mm_storeu_si128((__m128i *)rx, x);
+    _mm_storeu_si128((__m128i *)ry, y);
+    _mm_storeu_si128((__m128i *)rz, z);
+#endif
+    for (int j = 0; j < HEX_BATCH_WIDTH; ++j) {
+      r_pos[i + j].x = rx[j];
+      r_pos[i + j].y = ry[j];
+      r_pos[i + j].z = rz[j];
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    cube_round_i(&c_pos[i], &r_pos[i]);
+  }
+}
+
+void screen2map_i_batch(struct screen_pos *s_pos, struct map_ipos *m_pos, int n)
+{
+  int i = 0;
+#if defined(__AVX2__)
+  const __m256i idx_x = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+  const __m256i idx_y = _mm256_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15);
+  for (; i + 8 <= n; i += 8) {
+    const int *p = (const int *)(s_pos + i);
+    screen2map_avx2(_mm256_i32gather_epi32(p, idx_x, 4),
+        _mm256_i32gather_epi32(p, idx_y, 4), m_pos + i);
+  }
+#elif defined(__SSE2__)
+  for (; i + 4 <= n; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(s_pos + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(s_pos + i + 2));
+    /* deinterleave x0 y0 x1 y1 / x2 y2 x3 y3 */
+    __m128 xs = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b),
+        _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 ys = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b),
+        _MM_SHUFFLE(3, 1, 3, 1));
+    screen2map_sse2(_mm_castps_si128(xs), _mm_castps_si128(ys), m_pos + i);
+  }
+#endif
+  for (; i < n; ++i) {
+    screen2map_i(&s_pos[i], &m_pos[i]);
+  }
+}
+
+void screen_row2map_i(int x, int y, int n, struct map_ipos *m_pos)
+{
+  int i = 0;
+#if defined(__AVX2__)
+  __m256i sx = _mm256_add_epi32(_mm256_set1_epi32(x),
+      _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  __m256i sy = _mm256_set1_epi32(y);
+  for (; i + 8 <= n; i += 8) {
+    screen2map_avx2(sx, sy, m_pos + i);
+    sx = _mm256_add_epi32(sx, _mm256_set1_epi32(8));
+  }
+#elif defined(__SSE2__)
+  __m128i sx = _mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3));
+  __m128i sy = _mm_set1_epi32(y);
+  for (; i + 4 <= n; i += 4) {
+    screen2map_sse2(sx, sy, m_pos + i);
+    sx = _mm_add_epi32(sx, _mm_set1_epi32(4));
+  }
+#endif
+  for (; i < n; ++i) {
+    struct screen_pos s_pos = {x + i, y};
+    screen2map_i(&s_pos, &m_pos[i]);
+  }
+}
+
+void cube2map_i(struct cube_ipos *c_pos, struct map_ipos *m_pos)
+{
+  m_pos->x = c_pos->x + c_pos->z;
+  m_pos->y = -c_pos->z;
+}
+
+void map2cube_i(struct map_ipos *m_pos, struct cube_ipos *c_pos)
+{
+  c_pos->x = m_pos->x + m_pos->y;
+  c_pos->y = -m_pos->x;
+  c_pos->z = -m_pos->y;
+}
+
+void cube_add_i(struct cube_ipos *a, struct cube_ipos *b, struct cube_ipos *out)
+{
+  out->x = a->x + b->x;
+  out->y = a->y + b->y;
+  out->z = a->z + b->z;
+}
+
+void cube_sub_i(struct cube_ipos *a, struct cube_ipos *b, struct cube_ipos *out)
+{
+  out->x = a->x - b->x;
+  out->y = a->y - b->y;
+  out->z = a->z - b->z;
+}
+
+void cube_neighbor_i(struct cube_ipos *c_pos, int direction, struct cube_ipos *out)
+{
+  const struct map_ipos *d = &map_directions[direction];
+  out->x = c_pos->x + d->x + d->y;
+  out->y = c_pos->y - d->x;
+  out->z = c_pos->z - d->y;
+}
+
+int cube_distance_i(struct cube_ipos *a, struct cube_ipos *b)
+{
+  return (abs(a->x - b->x) + abs(a->y - b->y) + abs(a->z - b->z)) / 2;
+}
+
+void map_add_i(struct map_ipos *a, struct map_ipos *b, struct map_ipos *out)
+{
+  out->x = a->x + b->x;
+  out->y = a->y + b->y;
+}
+
+void map_sub_i(struct map_ipos *a, struct map_ipos *b, struct map_ipos *out)
+{
+  out->x = a->x - b->x;
+  out->y = a->y - b->y;
+}
+
+void map_neighbor_i(struct map_ipos *m_pos, int direction, struct map_ipos *out)
+{
+  out->x = m_pos->x + map_directions[direction].x;
+  out->y = m_pos->y + map_directions[direction].y;
+}
+
+int map_distance_i(struct map_ipos *a, struct map_ipos *b)
+{
+  int dx = a->x - b->x;
+  int dy = a->y - b->y;
+  return (abs(dx) + abs(dy) + abs(dx + dy)) / 2;
+}
+
+/* point i of n on the line from cube (0, 0, 0) to delta, split into the
+ * cell base and the rest out, both in cube coordinates: the point is base
+ * + out and its cell is base plus cube_round_i() of out. out stays below 2
+ * whatever the length of the line, so its float error is far smaller than
+ * the nudge that moves it a little off the cell edges, and points exactly
+ * between two cells always round to the same side. that holds for lines
+ * of up to about 100000 cells. */
+void cube_line_point(struct cube_ipos *delta, int i, int n,
+    struct cube_ipos *base, struct cube_pos *out)
+{
+  /* delta * i overflows an int on lines longer than 46340 cells */
+  long long x = (long long)delta->x * i;
+  long long y = (long long)delta->y * i;
+  int rx = (int)(x % n);
+  int ry = (int)(y % n);
+  rx += rx < 0 ? n : 0;
+  ry += ry < 0 ? n : 0;
+  base->x = (int)((x - rx) / n);
+  base->y = (int)((y - ry) / n);
+  base->z = -base->x - base->y;
+  float fx = (float)rx / (float)n;
+  float fy = (float)ry / (float)n;
+  out->x = 1e-6f + fx;
+  out->y = 2e-6f + fy;
+  out->z = -3e-6f - (fx + fy);
+}
+
+int map_line_i(struct map_ipos *a, struct map_ipos *b, struct map_ipos *out, int max)
+{
+  struct map_ipos d_pos;
+  struct cube_ipos delta;
+  int n = map_distance_i(a, b);
+  map_sub_i(b, a, &d_pos);
+  map2cube_i(&d_pos, &delta);
+  for (int i = 0; i <= n && i < max; ++i) {
+    struct cube_pos c_pos;
+    struct cube_ipos base;
+    struct cube_ipos r_pos;
+    struct map_ipos m_pos;
+    if (i == 0) {
+      out[i] = *a;
+      continue;
+    }
+    cube_line_point(&delta, i, n, &base, &c_pos);
+    cube_round_i(&c_pos, &r_pos);
+    cube_add_i(&base, &r_pos, &r_pos);
+    cube2map_i(&r_pos, &m_pos);
+    map_add_i(a, &m_pos, &out[i]);
+  }
+  return n + 1;
+}
+
 void print_screen_pos(struct screen_pos *s_pos)
 {
   printf("screen: %ix, %iy\n", s_pos->x, s_pos->y);
@@ -1,3 +1,6 @@
+#ifndef HEX_H
+#define HEX_H
+
 struct screen_pos {
   int x;
   int y;
@@ -14,13 +17,56 @@ struct cube_pos {
   float z;
 };
 
+/* integer versions of map_pos and cube_pos, used for map addressing */
+struct map_ipos {
+  int x;
+  int y;
+};
+
+struct cube_ipos {
+  int x;
+  int y;
+  int z;
+};
+
 //#define WIDTH 20.0f
 //#define HEIGHT 16.0f
 #define WIDTH 12.0f
 #define HEIGHT 8.0f
 
-void map_to_offset(struct map_pos *m_pos, struct map_pos *o_pos);
-void offset_to_map(struct map_pos *o_pos, struct map_pos *m_pos);
+#define HEX_DIRECTIONS 6
+
+extern const struct map_ipos map_directions[HEX_DIRECTIONS];
+
+enum hex_orientation {
+  HEX_POINTY,
+  HEX_FLAT
+};
+
+/* tile metrics chosen at runtime, see hex_layout_init().
+ * width and height are the size of one tile in pixels, origin is the
+ * screen position of map (0, 0). the remaining fields are derived. */
+struct hex_layout {
+  int width;
+  int height;
+  enum hex_orientation orientation;
+  struct screen_pos origin;
+
+  int builtin;
+  int local_w;
+  int local_h;
+  float inv_w;
+  float inv_row;
+  int step_exact;
+  struct screen_pos step_x;
+  struct screen_pos step_y;
+  int pick_w;
+  int pick_w_shift;
+  int pick_h;
+  int pick_rows;
+  signed char *pick;
+};
+
 void cube_round(struct cube_pos *c_pos);
 void map_round(struct map_pos *m_pos);
 void cube2screen(struct cube_pos* c_pos, struct screen_pos *s_pos);
@@ -28,3 +74,87 @@ void screen2cube(struct screen_pos *s_pos, struct cube_pos *c_pos);
 void cube2map(struct cube_pos *c_pos, struct map_pos *m_pos);
 void map2cube(struct map_pos *m_pos, struct cube_pos *c_pos);
 
+void map_to_offset_i(struct map_ipos *m_pos, struct map_ipos *o_pos);
+void offset_to_map_i(struct map_ipos *o_pos, struct map_ipos *m_pos);
+void cube_round_i(struct cube_pos *c_pos, struct cube_ipos *r_pos);
+void map_round_i(struct map_pos *m_pos, struct map_ipos *r_pos);
+void cube2screen_i(struct cube_ipos *c_pos, struct screen_pos *s_pos);
+void map2screen_i(struct map_ipos *m_pos, struct screen_pos *s_pos);
+void screen2map_i(struct screen_pos *s_pos, struct map_ipos *m_pos);
+void screen2map_i_lut(struct screen_pos *s_pos, struct map_ipos *m_pos);
+void screen2map_i_batch(struct screen_pos *s_pos, struct map_ipos *m_pos, int n);
+void screen_row2map_i(int x, int y, int n, struct map_ipos *m_pos);
+void cube_round_i_batch(struct cube_pos *c_pos, struct cube_ipos *r_pos, int n);
+void cube2map_i(struct cube_ipos *c_pos, struct map_ipos *m_pos);
+void map2cube_i(struct map_ipos *m_pos, struct cube_ipos *c_pos);
+
+void cube_add_i(struct cube_ipos *a, struct cube_ipos *b, struct cube_ipos *out);
+void cube_sub_i(struct cube_ipos *a, struct cube_ipos *b, struct cube_ipos *out);
+void cube_neighbor_i(struct cube_ipos *c_pos, int direction, struct cube_ipos *out);
+int cube_distance_i(struct cube_ipos *a, struct cube_ipos *b);
+void map_add_i(struct map_ipos *a, struct map_ipos *b, struct map_ipos *out);
+void map_sub_i(struct map_ipos *a, struct map_ipos *b, struct map_ipos *out);
+void map_neighbor_i(struct map_ipos *m_pos, int direction, struct map_ipos *out);
+int map_distance_i(struct map_ipos *a, struct map_ipos *b);
+void cube_line_point(struct cube_ipos *delta, int i, int n,
+    struct cube_ipos *base, struct cube_pos *out);
+int map_line_i(struct map_ipos *a, struct map_ipos *b, struct map_ipos *out, int max);
+
+enum hex_iter_type {
+  HEX_ITER_RING,
+  HEX_ITER_SPIRAL,
+  HEX_ITER_RANGE,
+  HEX_ITER_RECT
+};
+
+/* walks over map cells without allocating, e.g.
+ *
+ *   struct hex_iter it;
+ *   hex_iter_range(&it, layout, &center, 3);
+ *   while (hex_iter_next(&it)) {
+ *     ... it.pos, it.screen ...
+ *   }
+ *
+ * pos is the current cell and screen its position in the layout. */
+struct hex_iter {
+  struct map_ipos pos;
+  struct screen_pos screen;
+
+  enum hex_iter_type type;
+  struct hex_layout *layout;
+  struct map_ipos center;
+  int count;
+  int started;
+  int radius;
+  int side;
+  int step;
+  int row;
+  int x_end;
+  int x0;
+  int w;
+};
+
+void hex_layout_init(struct hex_layout *layout, int width, int height,
+    enum hex_orientation orientation);
+void hex_layout_free(struct hex_layout *layout);
+void hex_layout_set_origin(struct hex_layout *layout, int x, int y);
+void hex_layout_cube2screen(struct hex_layout *layout, struct cube_pos *c_pos,
+    struct screen_pos *s_pos);
+void hex_layout_screen2cube(struct hex_layout *layout, struct screen_pos *s_pos,
+    struct cube_pos *c_pos);
+void hex_layout_map2screen_i(struct hex_layout *layout, struct map_ipos *m_pos,
+    struct screen_pos *s_pos);
+void hex_layout_screen2map_i(struct hex_layout *layout, struct screen_pos *s_pos,
+    struct map_ipos *m_pos);
+
+void hex_iter_ring(struct hex_iter *it, struct hex_layout *layout,
+    struct map_ipos *center, int radius);
+void hex_iter_spiral(struct hex_iter *it, struct hex_layout *layout,
+    struct map_ipos *center, int radius);
+void hex_iter_range(struct hex_iter *it, struct hex_layout *layout,
+    struct map_ipos *center, int radius);
+void hex_iter_rect(struct hex_iter *it, struct hex_layout *layout,
+    int x, int y, int w, int h);
+int hex_iter_next(struct hex_iter *it);
+
+#endif
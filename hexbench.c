@@ -0,0 +1,1221 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "hex.h"
+#include "hexflow.h"
+#include "hexfov.h"
+#include "hexlos.h"
+#include "hexpath.h"
+
+/* hexbench: throughput of the hex.c conversions and round trip checks
+ *
+ *   hexbench [-n ops] [-r reps] [-w warmup] [-c range] [-f text|csv|json]
+ *
+ * every benchmark runs warmup + reps repetitions of ops calls over a
+ * fixed set of pseudo random inputs; the median repetition is reported.
+ * the checks walk every cell (and every pixel of the matching screen
+ * area) within -range .. range. the iterator, line of sight, field of
+ * view, path and flow checks compare against brute force versions on
+ * areas that grow with range. the exit status is 1 if a check failed. */
+
+#define INPUTS 4096
+#define INPUT_MASK (INPUTS - 1)
+
+enum format {
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+static struct screen_pos in_screen[INPUTS];
+static struct cube_pos in_cube[INPUTS];
+static struct map_pos in_map[INPUTS];
+static struct map_pos in_map_frac[INPUTS];
+static struct map_ipos in_map_i[INPUTS];
+static struct map_ipos out_map_i[INPUTS];
+static struct hex_layout layout_20x16;
+
+static volatile float sink_f;
+static volatile int sink_i;
+
+static void bench_screen2cube(int n)
+{
+  struct cube_pos c_pos;
+  float sum = 0;
+  for (int i = 0; i < n; ++i) {
+    screen2cube(&in_screen[i & INPUT_MASK], &c_pos);
+    sum += c_pos.x;
+  }
+  sink_f = sum;
+}
+
+static void bench_cube2map(int n)
+{
+  struct map_pos m_pos;
+  float sum = 0;
+  for (int i = 0; i < n; ++i) {
+    cube2map(&in_cube[i & INPUT_MASK], &m_pos);
+    sum += m_pos.x;
+  }
+  sink_f = sum;
+}
+
+static void bench_map2cube(int n)
+{
+  struct cube_pos c_pos;
+  float sum = 0;
+  for (int i = 0; i < n; ++i) {
+    map2cube(&in_map_frac[i & INPUT_MASK], &c_pos);
+    sum += c_pos.x;
+  }
+  sink_f = sum;
+}
+
+static void bench_cube_round(int n)
+{
+  float sum = 0;
+  for (int i = 0; i < n; ++i) {
+    struct cube_pos c_pos = in_cube[i & INPUT_MASK];
+    cube_round(&c_pos);
+    sum += c_pos.x;
+  }
+  sink_f = sum;
+}
+
+static void bench_map_round(int n)
+{
+  float sum = 0;
+  for (int i = 0; i < n; ++i) {
+    struct map_pos m_pos = in_map_frac[i & INPUT_MASK];
+    map_round(&m_pos);
+    sum += m_pos.x;
+  }
+  sink_f = sum;
+}
+
+static void bench_screen2map_i(int n)
+{
+  struct map_ipos m_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    screen2map_i(&in_screen[i & INPUT_MASK], &m_pos);
+    sum += m_pos.x;
+  }
+  sink_i = sum;
+}
+
+static void bench_screen2map_i_lut(int n)
+{
+  struct map_ipos m_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    screen2map_i_lut(&in_screen[i & INPUT_MASK], &m_pos);
+    sum += m_pos.x;
+  }
+  sink_i = sum;
+}
+
+static void bench_screen2map_i_batch(int n)
+{
+  int sum = 0;
+  for (int i = 0; i < n; i += INPUTS) {
+    int count = n - i < INPUTS ? n - i : INPUTS;
+    screen2map_i_batch(in_screen, out_map_i, count);
+    sum += out_map_i[0].x;
+  }
+  sink_i = sum;
+}
+
+static void bench_screen_row2map_i(int n)
+{
+  int sum = 0;
+  for (int i = 0; i < n; i += INPUTS) {
+    int count = n - i < INPUTS ? n - i : INPUTS;
+    screen_row2map_i(-INPUTS / 2, i / INPUTS, count, out_map_i);
+    sum += out_map_i[0].x;
+  }
+  sink_i = sum;
+}
+
+static void bench_layout_screen2map_i(int n)
+{
+  struct map_ipos m_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    hex_layout_screen2map_i(&layout_20x16, &in_screen[i & INPUT_MASK], &m_pos);
+    sum += m_pos.x;
+  }
+  sink_i = sum;
+}
+
+static void bench_map_round_i(int n)
+{
+  struct map_ipos m_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    map_round_i(&in_map_frac[i & INPUT_MASK], &m_pos);
+    sum += m_pos.x;
+  }
+  sink_i = sum;
+}
+
+static void bench_map_to_offset_i(int n)
+{
+  struct map_ipos o_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    map_to_offset_i(&in_map_i[i & INPUT_MASK], &o_pos);
+    sum += o_pos.x;
+  }
+  sink_i = sum;
+}
+
+static void bench_offset_to_map_i(int n)
+{
+  struct map_ipos m_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    offset_to_map_i(&in_map_i[i & INPUT_MASK], &m_pos);
+    sum += m_pos.x;
+  }
+  sink_i = sum;
+}
+
+static void bench_map2screen_i(int n)
+{
+  struct screen_pos s_pos;
+  int sum = 0;
+  for (int i = 0; i < n; ++i) {
+    map2screen_i(&in_map_i[i & INPUT_MASK], &s_pos);
+    sum += s_pos.x;
+  }
+  sink_i = sum;
+}
+
+struct bench {
+  const char *name;
+  void (*run)(int n);
+};
+
+static struct bench benches[] = {
+  {"screen2cube", bench_screen2cube},
+  {"cube2map", bench_cube2map},
+  {"map2cube", bench_map2cube},
+  {"cube_round", bench_cube_round},
+  {"map_round", bench_map_round},
+  {"screen2map_i", bench_screen2map_i},
+  {"screen2map_i_lut", bench_screen2map_i_lut},
+  {"screen2map_i_batch", bench_screen2map_i_batch},
+  {"screen_row2map_i", bench_screen_row2map_i},
+  {"hex_layout_screen2map_i", bench_layout_screen2map_i},
+  {"map_round_i", bench_map_round_i},
+  {"map_to_offset_i", bench_map_to_offset_i},
+  {"offset_to_map_i", bench_offset_to_map_i},
+  {"map2screen_i", bench_map2screen_i},
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/* returns the median ns per call */
+static double bench_run(struct bench *bench, int ops, int reps, int warmup)
+{
+  double times[reps];
+  for (int i = 0; i < warmup; ++i) {
+    bench->run(ops);
+  }
+  for (int i = 0; i < reps; ++i) {
+    double start = now();
+    bench->run(ops);
+    times[i] = now() - start;
+  }
+  qsort(times, reps, sizeof(*times), compare_double);
+  return times[reps / 2] * 1e9 / ops;
+}
+
+static void fill_inputs(void)
+{
+  /* fixed seed, the inputs are the same for every run */
+  unsigned int state = 12345;
+  for (int i = 0; i < INPUTS; ++i) {
+    int v[4];
+    for (int j = 0; j < 4; ++j) {
+      state = state * 1103515245u + 12345u;
+      v[j] = (int)((state >> 8) & 0xffff) - 0x8000;
+    }
+    in_screen[i].x = v[0];
+    in_screen[i].y = v[1];
+    in_map[i].x = v[2] / 64;
+    in_map[i].y = v[3] / 64;
+    in_map_i[i].x = v[2] / 64;
+    in_map_i[i].y = v[3] / 64;
+    in_map_frac[i].x = v[2] / 64.0f;
+    in_map_frac[i].y = v[3] / 64.0f;
+    map2cube(&in_map_frac[i], &in_cube[i]);
+  }
+}
+
+/* checks */
+
+struct check {
+  const char *name;
+  long tested;
+  long failed;
+};
+
+/* the same generator as fill_inputs() */
+static unsigned int check_rand(unsigned int *state)
+{
+  *state = *state * 1103515245u + 12345u;
+  return *state >> 8;
+}
+
+static void float_screen2map(struct screen_pos *s_pos, struct map_ipos *m_pos)
+{
+  struct cube_pos c_pos;
+  struct map_pos f_pos;
+  screen2cube(s_pos, &c_pos);
+  cube_round(&c_pos);
+  cube2map(&c_pos, &f_pos);
+  m_pos->x = f_pos.x;
+  m_pos->y = f_pos.y;
+}
+
+/* squared length of a cube space vector */
+static long long cube_distance2(long long x, long long y, long long z)
+{
+  return x * x + y * y + z * z;
+}
+
+/* squared distance of pixel (px, py) of a pointy grid of w * h tiles to a
+ * cell center in exact integer math, scaled by (3 * w * h)^2 */
+static long long local_distance(long long w, long long h, long long px,
+    long long py, struct map_ipos *m_pos)
+{
+  long long k = 3 * w * h;
+  long long x = 2 * w * py + 3 * h * px;
+  long long y = 2 * w * py - 3 * h * px;
+  long long z = -x - y;
+  return cube_distance2(x - k * (m_pos->x + m_pos->y), y + k * m_pos->x,
+      z + k * m_pos->y);
+}
+
+static long long pixel_distance(struct screen_pos *s_pos, struct map_ipos *m_pos)
+{
+  return local_distance(WIDTH, HEIGHT, s_pos->x, s_pos->y, m_pos);
+}
+
+/* the same for any layout, in its local coordinates */
+static long long layout_distance(struct hex_layout *layout,
+    struct screen_pos *s_pos, struct map_ipos *m_pos)
+{
+  long long x = s_pos->x - layout->origin.x;
+  long long y = s_pos->y - layout->origin.y;
+  if (layout->orientation == HEX_FLAT) {
+    return local_distance(layout->local_w, layout->local_h, y, x, m_pos);
+  }
+  return local_distance(layout->local_w, layout->local_h, x, y, m_pos);
+}
+
+static void check_map_round_trip(struct check *check, int range)
+{
+  for (int y = -range; y <= range; ++y) {
+    for (int x = -range; x <= range; ++x) {
+      struct map_pos m_pos = {x, y};
+      struct map_pos back;
+      struct cube_pos c_pos;
+      struct map_ipos m_ipos = {x, y};
+      struct map_ipos o_ipos;
+      struct map_ipos back_i;
+      int failed = 0;
+
+      map2cube(&m_pos, &c_pos);
+      cube2map(&c_pos, &back);
+      failed |= back.x != x || back.y != y;
+
+      map_to_offset_i(&m_ipos, &o_ipos);
+      offset_to_map_i(&o_ipos, &back_i);
+      failed |= back_i.x != x || back_i.y != y;
+      failed |= o_ipos.x != x + (int)floorf(y / 2.0f) || o_ipos.y != y;
+
+      struct screen_pos s_pos;
+      map2screen_i(&m_ipos, &s_pos);
+      screen2map_i(&s_pos, &back_i);
+      failed |= back_i.x != x || back_i.y != y;
+
+      check->tested++;
+      check->failed += failed;
+    }
+  }
+}
+
+static void check_map_round(struct check *check, int range)
+{
+  for (int y = -range * 4; y <= range * 4; ++y) {
+    for (int x = -range * 4; x <= range * 4; ++x) {
+      struct map_pos m_pos = {x / 4.0f, y / 4.0f};
+      struct map_ipos r_pos;
+      map_round_i(&m_pos, &r_pos);
+      map_round(&m_pos);
+      check->tested++;
+      check->failed += r_pos.x != m_pos.x || r_pos.y != m_pos.y;
+    }
+  }
+}
+
+static void check_screen_int(struct check *check, int range)
+{
+  int w = range * WIDTH;
+  for (int y = -w; y <= w; ++y) {
+    for (int x = -w; x <= w; ++x) {
+      struct screen_pos s_pos = {x, y};
+      struct map_ipos a;
+      struct map_ipos b;
+      float_screen2map(&s_pos, &a);
+      screen2map_i(&s_pos, &b);
+      check->tested++;
+      check->failed += a.x != b.x || a.y != b.y;
+    }
+  }
+}
+
+static void check_screen_batch(struct check *check, int range)
+{
+  int w = range * WIDTH;
+  int n = 2 * w + 1;
+  struct map_ipos *row = malloc(n * sizeof(*row));
+  struct map_ipos *batch = malloc(n * sizeof(*batch));
+  struct screen_pos *s_pos = malloc(n * sizeof(*s_pos));
+  for (int y = -w; y <= w; ++y) {
+    for (int i = 0; i < n; ++i) {
+      /* scatter the batch input a bit so it is not just the row again */
+      s_pos[i].x = -w + (i * 7) % n;
+      s_pos[i].y = y + i % 3;
+    }
+    screen_row2map_i(-w, y, n, row);
+    screen2map_i_batch(s_pos, batch, n);
+    for (int i = 0; i < n; ++i) {
+      struct screen_pos p = {-w + i, y};
+      struct map_ipos ref;
+      screen2map_i(&p, &ref);
+      check->failed += ref.x != row[i].x || ref.y != row[i].y;
+      screen2map_i(&s_pos[i], &ref);
+      check->failed += ref.x != batch[i].x || ref.y != batch[i].y;
+      check->tested += 2;
+    }
+  }
+  free(row);
+  free(batch);
+  free(s_pos);
+}
+
+/* the table may only differ from the float path where a pixel is exactly
+ * as far from both cells */
+static void check_screen_lut(struct check *check, int range)
+{
+  int w = range * WIDTH;
+  for (int y = -w; y <= w; ++y) {
+    for (int x = -w; x <= w; ++x) {
+      struct screen_pos s_pos = {x, y};
+      struct map_ipos a;
+      struct map_ipos b;
+      screen2map_i(&s_pos, &a);
+      screen2map_i_lut(&s_pos, &b);
+      check->tested++;
+      if (a.x != b.x || a.y != b.y) {
+        check->failed += pixel_distance(&s_pos, &a) != pixel_distance(&s_pos, &b);
+      }
+    }
+  }
+}
+
+static void check_layout(struct check *check, int range)
+{
+  struct hex_layout layout;
+  hex_layout_init(&layout, WIDTH, HEIGHT, HEX_POINTY);
+  int w = range * WIDTH;
+  for (int y = -w; y <= w; ++y) {
+    for (int x = -w; x <= w; ++x) {
+      struct screen_pos s_pos = {x, y};
+      struct map_ipos a;
+      struct map_ipos b;
+      screen2map_i_lut(&s_pos, &a);
+      hex_layout_screen2map_i(&layout, &s_pos, &b);
+      check->tested++;
+      check->failed += a.x != b.x || a.y != b.y;
+    }
+  }
+  hex_layout_free(&layout);
+}
+
+/* layouts whose pick tables are built differently: a width that is a
+ * power of two (shift instead of division), a row pair that does not end
+ * on a whole pixel (pick_rows 4) and flat ones, some moved by an origin */
+struct layout_def {
+  int width;
+  int height;
+  enum hex_orientation orientation;
+  int origin_x;
+  int origin_y;
+};
+
+static const struct layout_def layout_defs[] = {
+  {20, 16, HEX_POINTY, 0, 0},
+  {16, 12, HEX_POINTY, 5, -3},
+  {12, 7, HEX_POINTY, 0, 0},
+  {32, 9, HEX_POINTY, -7, 11},
+  {20, 16, HEX_FLAT, 0, 0},
+  {13, 9, HEX_FLAT, 3, 4},
+  {12, 16, HEX_FLAT, 0, 0},
+};
+
+#define N_LAYOUT_DEFS (int)(sizeof(layout_defs) / sizeof(*layout_defs))
+
+static void layout_def_init(struct hex_layout *layout, const struct layout_def *def)
+{
+  hex_layout_init(layout, def->width, def->height, def->orientation);
+  hex_layout_set_origin(layout, def->origin_x, def->origin_y);
+}
+
+/* every pixel has to pick a cell whose center is nearest, either side of
+ * a tie will do, and every cell center its own cell */
+static void check_layouts(struct check *check, int range)
+{
+  int w = range * WIDTH;
+  for (int l = 0; l < N_LAYOUT_DEFS; ++l) {
+    struct hex_layout layout;
+    layout_def_init(&layout, &layout_defs[l]);
+    for (int y = -w; y <= w; ++y) {
+      for (int x = -w; x <= w; ++x) {
+        struct screen_pos s_pos = {x, y};
+        struct cube_pos c_pos;
+        struct cube_ipos c_ipos;
+        struct map_ipos near;
+        struct map_ipos picked;
+        hex_layout_screen2cube(&layout, &s_pos, &c_pos);
+        cube_round_i(&c_pos, &c_ipos);
+        cube2map_i(&c_ipos, &near);
+        long long best = layout_distance(&layout, &s_pos, &near);
+        for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+          struct map_ipos n_pos;
+          map_neighbor_i(&near, dir, &n_pos);
+          long long d = layout_distance(&layout, &s_pos, &n_pos);
+          best = d < best ? d : best;
+        }
+        hex_layout_screen2map_i(&layout, &s_pos, &picked);
+        check->tested++;
+        check->failed += layout_distance(&layout, &s_pos, &picked) != best;
+      }
+    }
+    for (int y = -range; y <= range; ++y) {
+      for (int x = -range; x <= range; ++x) {
+        struct map_ipos m_pos = {x, y};
+        struct screen_pos s_pos;
+        struct map_ipos back;
+        hex_layout_map2screen_i(&layout, &m_pos, &s_pos);
+        hex_layout_screen2map_i(&layout, &s_pos, &back);
+        check->tested++;
+        check->failed += back.x != x || back.y != y;
+      }
+    }
+    hex_layout_free(&layout);
+  }
+}
+
+static int iter_screen_ok(struct hex_iter *it)
+{
+  struct screen_pos s_pos;
+  hex_layout_map2screen_i(it->layout, &it->pos, &s_pos);
+  return s_pos.x == it->screen.x && s_pos.y == it->screen.y;
+}
+
+/* walks one ring, spiral or range iterator and checks it against the
+ * cells around center by distance. every cell is visited once, rings
+ * only hold cells at radius and spirals never step back inwards. */
+static int check_iter_shape(struct hex_iter *it, enum hex_iter_type type,
+    struct map_ipos *center, int radius, int *seen, int max_radius)
+{
+  int side = 2 * max_radius + 1;
+  int count = 0;
+  int last = 0;
+  int failed = 0;
+  memset(seen, 0, side * side * sizeof(*seen));
+  while (hex_iter_next(it)) {
+    int d = map_distance_i(&it->pos, center);
+    if (d > radius) {
+      failed = 1;
+      break;
+    }
+    failed |= seen[(it->pos.x - center->x + max_radius)
+        + (it->pos.y - center->y + max_radius) * side]++;
+    failed |= type == HEX_ITER_RING && d != radius;
+    failed |= type == HEX_ITER_SPIRAL && d < last;
+    failed |= !iter_screen_ok(it);
+    last = d;
+    ++count;
+  }
+  if (type == HEX_ITER_RING) {
+    failed |= count != (radius ? 6 * radius : 1);
+  } else {
+    failed |= count != 1 + 3 * radius * (radius + 1);
+  }
+  return failed;
+}
+
+/* hex_iter_rect() has to visit every cell of the offset rectangle once */
+static int check_iter_rect(struct hex_iter *it, int x, int y, int w, int h,
+    int *seen)
+{
+  int count = 0;
+  int failed = 0;
+  memset(seen, 0, w * h * sizeof(*seen));
+  while (hex_iter_next(it)) {
+    struct map_ipos o_pos;
+    map_to_offset_i(&it->pos, &o_pos);
+    if (o_pos.x < x || o_pos.x >= x + w || o_pos.y < y || o_pos.y >= y + h) {
+      failed = 1;
+      break;
+    }
+    failed |= seen[(o_pos.x - x) + (o_pos.y - y) * w]++;
+    failed |= !iter_screen_ok(it);
+    ++count;
+  }
+  return failed | (count != w * h);
+}
+
+static void check_iter(struct check *check, int range)
+{
+  struct map_ipos centers[] = {{0, 0}, {5, -3}, {-7, 12}};
+  int max_radius = range / 4;
+  int side = 2 * max_radius + 1;
+  int *seen = malloc(side * side * sizeof(*seen));
+  for (int l = -1; l < N_LAYOUT_DEFS; ++l) {
+    struct hex_layout layout;
+    if (l < 0) {
+      hex_layout_init(&layout, WIDTH, HEIGHT, HEX_POINTY);
+    } else {
+      layout_def_init(&layout, &layout_defs[l]);
+    }
+    for (int c = 0; c < (int)(sizeof(centers) / sizeof(*centers)); ++c) {
+      for (int r = 0; r <= max_radius; ++r) {
+        struct hex_iter it;
+        hex_iter_ring(&it, &layout, &centers[c], r);
+        check->failed += check_iter_shape(&it, HEX_ITER_RING, &centers[c], r,
+            seen, max_radius);
+        hex_iter_spiral(&it, &layout, &centers[c], r);
+        check->failed += check_iter_shape(&it, HEX_ITER_SPIRAL, &centers[c], r,
+            seen, max_radius);
+        hex_iter_range(&it, &layout, &centers[c], r);
+        check->failed += check_iter_shape(&it, HEX_ITER_RANGE, &centers[c], r,
+            seen, max_radius);
+        hex_iter_rect(&it, &layout, centers[c].x, centers[c].y, r + 1,
+            side - r);
+        check->failed += check_iter_rect(&it, centers[c].x, centers[c].y,
+            r + 1, side - r, seen);
+        check->tested += 4;
+      }
+    }
+    hex_layout_free(&layout);
+  }
+  free(seen);
+}
+
+/* a fixed pattern of blocking cells, about one in five */
+static int check_blocked(void *data, int x, int y)
+{
+  (void)data;
+  unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u;
+  return (h >> 4) % 5 == 0;
+}
+
+/* cell c (relative to the line start) is a nearest cell to point i of n
+ * on the line to delta. both are scaled by n to stay in integers. */
+static int nearest_on_line(struct cube_ipos *delta, int i, int n,
+    struct cube_ipos *c)
+{
+  long long px = (long long)delta->x * i;
+  long long py = (long long)delta->y * i;
+  long long pz = (long long)delta->z * i;
+  long long d = cube_distance2(px - (long long)n * c->x, py - (long long)n * c->y,
+      pz - (long long)n * c->z);
+  for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+    struct cube_ipos o;
+    cube_neighbor_i(c, dir, &o);
+    if (cube_distance2(px - (long long)n * o.x, py - (long long)n * o.y,
+          pz - (long long)n * o.z) < d) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* map_line_i() against the exact line: it starts and ends on the given
+ * cells, moves one cell per point and every point is a nearest cell of
+ * the point it stands for. hex_los() and hex_los_batch() have to see
+ * through exactly the lines whose inner cells are all clear. */
+static void check_los(struct check *check, int range)
+{
+  struct map_ipos origins[] = {{0, 0}, {3, -8}, {-11, 5}};
+  int r = range / 4;
+  int side = 2 * r + 1;
+  struct map_ipos *line = malloc((2 * r + 1) * sizeof(*line));
+  struct hex_los_query *queries = malloc(side * side * sizeof(*queries));
+  unsigned char *clear = malloc(side * side);
+  unsigned char *visible = malloc(side * side);
+  for (int o = 0; o < (int)(sizeof(origins) / sizeof(*origins)); ++o) {
+    struct map_ipos *from = &origins[o];
+    int n = 0;
+    for (int dy = -r; dy <= r; ++dy) {
+      for (int dx = -r; dx <= r; ++dx) {
+        struct map_ipos to = {from->x + dx, from->y + dy};
+        struct map_ipos d_pos = {dx, dy};
+        struct cube_ipos delta;
+        map2cube_i(&d_pos, &delta);
+        int len = map_line_i(from, &to, line, 2 * r + 1) - 1;
+        int failed = line[0].x != from->x || line[0].y != from->y
+          || line[len].x != to.x || line[len].y != to.y;
+        clear[n] = 1;
+        for (int i = 1; i <= len; ++i) {
+          struct map_ipos m_pos;
+          struct cube_ipos c_pos;
+          map_sub_i(&line[i], from, &m_pos);
+          map2cube_i(&m_pos, &c_pos);
+          failed |= map_distance_i(&line[i - 1], &line[i]) != 1;
+          failed |= !nearest_on_line(&delta, i, len, &c_pos);
+          if (i < len && check_blocked(NULL, line[i].x, line[i].y)) {
+            clear[n] = 0;
+          }
+        }
+        failed |= hex_los(from, &to, check_blocked, NULL) != clear[n];
+        queries[n].from = *from;
+        queries[n].to = to;
+        ++n;
+        check->tested++;
+        check->failed += failed;
+      }
+    }
+    hex_los_batch(queries, n, check_blocked, NULL, visible);
+    for (int i = 0; i < n; ++i) {
+      check->tested++;
+      check->failed += visible[i] != clear[i];
+    }
+  }
+  free(visible);
+  free(clear);
+  free(queries);
+  free(line);
+}
+
+/* v / d rounded to the nearest integer, d > 0 and v / d never half way */
+static long long round_div(long long v, long long d)
+{
+  long long q = v / d;
+  long long r = v % d;
+  if (r < 0) {
+    r += d;
+    --q;
+  }
+  return 2 * r > d ? q + 1 : q;
+}
+
+/* the cell of point i of n on the line to delta with the nudge of
+ * cube_line_point() made arbitrarily small: the point and the nudge
+ * (1, 2, -3) are scaled by 1000 * n and by n, which keeps the nudge below
+ * any real difference for lines of up to 100000 cells. */
+static void exact_line_cell(struct cube_ipos *delta, int i, int n,
+    struct cube_ipos *c)
+{
+  long long d = 1000LL * n;
+  long long x = 1000LL * delta->x * i + 1;
+  long long y = 1000LL * delta->y * i + 2;
+  long long z = 1000LL * delta->z * i - 3;
+  long long rx = round_div(x, d);
+  long long ry = round_div(y, d);
+  long long rz = round_div(z, d);
+  long long ex = llabs(x - rx * d);
+  long long ey = llabs(y - ry * d);
+  long long ez = llabs(z - rz * d);
+  if (ex > ey && ex > ez) {
+    rx = -ry - rz;
+  } else if (ey > ez) {
+    ry = -rx - rz;
+  } else {
+    rz = -rx - ry;
+  }
+  c->x = rx;
+  c->y = ry;
+  c->z = rz;
+}
+
+/* map_line_i() on long lines, up to 64 * range cells: points exactly
+ * between two cells have to go to the side the nudge picks, however far
+ * they are from the start of the line. */
+static void check_line(struct check *check, int range)
+{
+  unsigned int state = 6;
+  int max = 64 * range;
+  struct map_ipos *line = malloc((2 * max + 1) * sizeof(*line));
+  struct map_ipos from = {-7, 12};
+  for (int k = 0; k < 64; ++k) {
+    struct map_ipos to;
+    struct map_ipos d_pos;
+    struct cube_ipos delta;
+    d_pos.x = (int)(check_rand(&state) % (2 * max + 1)) - max;
+    d_pos.y = (int)(check_rand(&state) % (2 * max + 1)) - max;
+    /* every other line along a cell edge, those have the most ties */
+    if (k & 1) {
+      d_pos.y = -2 * d_pos.x;
+      d_pos.y = d_pos.y < -max ? -max : d_pos.y > max ? max : d_pos.y;
+      d_pos.x = -d_pos.y / 2;
+    }
+    map_add_i(&from, &d_pos, &to);
+    map2cube_i(&d_pos, &delta);
+    int n = map_line_i(&from, &to, line, 2 * max + 1) - 1;
+    int failed = 0;
+    for (int i = 1; i <= n; ++i) {
+      struct map_ipos m_pos;
+      struct cube_ipos c_pos;
+      struct cube_ipos want;
+      map_sub_i(&line[i], &from, &m_pos);
+      map2cube_i(&m_pos, &c_pos);
+      exact_line_cell(&delta, i, n, &want);
+      failed |= c_pos.x != want.x || c_pos.y != want.y || c_pos.z != want.z;
+    }
+    check->tested++;
+    check->failed += failed;
+  }
+  free(line);
+}
+
+struct span {
+  float lo;
+  float hi;
+};
+
+static int compare_span(const void *a, const void *b)
+{
+  float la = ((const struct span *)a)->lo;
+  float lb = ((const struct span *)b)->lo;
+  return (la > lb) - (la < lb);
+}
+
+/* spans that touch are joined, one of the joined runs has to hold all of
+ * lo .. hi */
+static int spans_cover(struct span *spans, int n, float lo, float hi)
+{
+  struct span sorted[n > 0 ? n : 1];
+  memcpy(sorted, spans, n * sizeof(*spans));
+  qsort(sorted, n, sizeof(*sorted), compare_span);
+  for (int i = 0; i < n;) {
+    struct span run = sorted[i++];
+    while (i < n && sorted[i].lo <= run.hi) {
+      run.hi = sorted[i].hi > run.hi ? sorted[i].hi : run.hi;
+      ++i;
+    }
+    if (run.lo <= lo && run.hi >= hi) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* the rules of hexfov.c without its sorted shadow lists: cell i of ring d
+ * in a sector spans (i - .5) / d .. (i + .5) / d and is hidden if the
+ * spans of the visible opaque cells of nearer rings of that sector cover
+ * it. visible is the (2 * radius + 1)^2 box around origin. */
+static void brute_fov(struct map_ipos *origin, int radius, unsigned char *visible)
+{
+  int side = 2 * radius + 1;
+  struct span *spans = malloc((radius + 1) * (radius + 2) / 2 * sizeof(*spans));
+  memset(visible, 0, side * side);
+  visible[radius + radius * side] = 1;
+  for (int sector = 0; sector < HEX_DIRECTIONS; ++sector) {
+    const struct map_ipos *out = &map_directions[sector];
+    const struct map_ipos *along = &map_directions[(sector + 2) % HEX_DIRECTIONS];
+    int n_spans = 0;
+    for (int d = 1; d <= radius; ++d) {
+      int n_old = n_spans;
+      for (int i = 0; i <= d; ++i) {
+        float lo = (i - 0.5f) / d;
+        float hi = (i + 0.5f) / d;
+        lo = lo < 0.0f ? 0.0f : lo;
+        hi = hi > 1.0f ? 1.0f : hi;
+        if (spans_cover(spans, n_old, lo, hi)) {
+          continue;
+        }
+        int x = out->x * d + along->x * i;
+        int y = out->y * d + along->y * i;
+        visible[(x + radius) + (y + radius) * side] = 1;
+        if (check_blocked(NULL, origin->x + x, origin->y + y)) {
+          spans[n_spans].lo = lo;
+          spans[n_spans].hi = hi;
+          ++n_spans;
+        }
+      }
+    }
+  }
+  free(spans);
+}
+
+/* a walk of hex_fov_update() calls, moving by one cell, standing still
+ * and jumping, against hex_fov_compute() and brute_fov() for every cell
+ * around the origin */
+static void check_fov(struct check *check, int range)
+{
+  int radius = 8;
+  int side = 2 * radius + 1;
+  unsigned char *expect = malloc(side * side);
+  struct hex_fov walk;
+  struct hex_fov fresh;
+  struct map_ipos origin = {0, 0};
+  unsigned int state = 54321;
+  hex_fov_init(&walk, radius);
+  hex_fov_init(&fresh, radius);
+  for (int step = 0; step <= range; ++step) {
+    int move = check_rand(&state) % 8;
+    if (move < HEX_DIRECTIONS) {
+      map_neighbor_i(&origin, move, &origin);
+    } else if (move == HEX_DIRECTIONS) {
+      origin.x += 3;
+      origin.y -= 2;
+    }
+    hex_fov_update(&walk, &origin, check_blocked, NULL);
+    hex_fov_compute(&fresh, &origin, check_blocked, NULL);
+    brute_fov(&origin, radius, expect);
+    for (int dy = -radius - 1; dy <= radius + 1; ++dy) {
+      for (int dx = -radius - 1; dx <= radius + 1; ++dx) {
+        struct map_ipos pos = {origin.x + dx, origin.y + dy};
+        int want = 0;
+        if (map_distance_i(&pos, &origin) <= radius) {
+          want = expect[(dx + radius) + (dy + radius) * side];
+        }
+        check->tested++;
+        check->failed += hex_fov_visible(&walk, pos.x, pos.y) != want
+          || hex_fov_visible(&fresh, pos.x, pos.y) != want;
+      }
+    }
+  }
+  hex_fov_free(&fresh);
+  hex_fov_free(&walk);
+  free(expect);
+}
+
+/* map sizes and tile costs for the path and flow checks, tile 2 is never
+ * free so some cells are always blocked or expensive */
+static const int search_sizes[][2] = {{24, 18}, {31, 12}, {17, 9}};
+static const int search_costs[][3] = {{1, 3, -1}, {0, 1, -1}, {1, 0, 5}};
+
+#define N_SEARCH_SIZES (int)(sizeof(search_sizes) / sizeof(*search_sizes))
+#define N_SEARCH_COSTS (int)(sizeof(search_costs) / sizeof(*search_costs))
+
+static void random_tiles(struct mmap *map, unsigned int *state)
+{
+  for (int y = 0; y < map->h; ++y) {
+    for (int x = 0; x < map->w; ++x) {
+      mmap_set(map, x + y / 2, y, check_rand(state) % 3);
+    }
+  }
+}
+
+/* cost from every cell to the nearest goal, stepping onto a cell costs
+ * cost[tile] and negative costs block. every cell is relaxed over and
+ * over until nothing changes. */
+static void brute_dist(struct mmap *map, const int *cost,
+    struct map_ipos *goals, int n_goals, unsigned int *dist)
+{
+  for (int i = 0; i < map->w * map->h; ++i) {
+    dist[i] = UINT_MAX;
+  }
+  for (int i = 0; i < n_goals; ++i) {
+    dist[goals[i].x + goals[i].y * map->w] = 0;
+  }
+  for (int changed = 1; changed;) {
+    changed = 0;
+    for (int y = 0; y < map->h; ++y) {
+      for (int x = 0; x < map->w; ++x) {
+        unsigned int *d = &dist[x + y * map->w];
+        if (cost[mmap_get(map, x, y)] < 0) {
+          continue;
+        }
+        for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+          int nx = x + map_directions[dir].x;
+          int ny = y + map_directions[dir].y;
+          map_normalize_coordinates(map, &nx, &ny);
+          int step = cost[mmap_get(map, nx, ny)];
+          unsigned int nd = dist[nx + ny * map->w];
+          if (step >= 0 && nd != UINT_MAX && nd + step < *d) {
+            *d = nd + step;
+            changed = 1;
+          }
+        }
+      }
+    }
+  }
+}
+
+static int is_neighbor(struct mmap *map, struct map_ipos *a, struct map_ipos *b)
+{
+  for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+    int x = a->x + map_directions[dir].x;
+    int y = a->y + map_directions[dir].y;
+    map_normalize_coordinates(map, &x, &y);
+    if (x == b->x && y == b->y) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* hex_path_find() against brute_dist(): a path of neighbors from start
+ * to goal of the cheapest cost, or none if the goal can not be reached */
+static void check_path(struct check *check, int range)
+{
+  unsigned int state = 777;
+  for (int s = 0; s < N_SEARCH_SIZES; ++s) {
+    int w = search_sizes[s][0];
+    int h = search_sizes[s][1];
+    struct mmap map;
+    struct hex_path path;
+    unsigned int *dist = malloc(w * h * sizeof(*dist));
+    struct map_ipos *out = malloc(w * h * sizeof(*out));
+    mmap_init(&map, w, h, 0);
+    hex_path_init(&path, w, h);
+    for (int c = 0; c < N_SEARCH_COSTS; ++c) {
+      const int *cost = search_costs[c];
+      for (int t = 0; t < 3; ++t) {
+        hex_path_set_cost(&path, t, cost[t]);
+      }
+      for (int q = 0; q <= range; ++q) {
+        if (q % 8 == 0) {
+          random_tiles(&map, &state);
+        }
+        struct map_ipos start = {check_rand(&state) % w, check_rand(&state) % h};
+        struct map_ipos goal = {check_rand(&state) % w, check_rand(&state) % h};
+        if (cost[mmap_get(&map, start.x, start.y)] < 0) {
+          continue;
+        }
+        brute_dist(&map, cost, &goal, 1, dist);
+        unsigned int want = dist[start.x + start.y * w];
+        int n = hex_path_find(&path, &map, &start, &goal, out, w * h);
+        int failed = (n < 0) != (want == UINT_MAX);
+        if (n > 0 && !failed) {
+          unsigned int sum = 0;
+          failed |= out[0].x != start.x || out[0].y != start.y
+            || out[n - 1].x != goal.x || out[n - 1].y != goal.y;
+          for (int i = 1; i < n; ++i) {
+            failed |= !is_neighbor(&map, &out[i - 1], &out[i]);
+            sum += cost[mmap_get(&map, out[i].x, out[i].y)];
+          }
+          failed |= sum != want;
+        }
+        check->tested++;
+        check->failed += failed;
+      }
+    }
+    hex_path_free(&path);
+    mmap_free(&map);
+    free(out);
+    free(dist);
+  }
+}
+
+/* hex_flow_build() against brute_dist() with 1 to 4 threads: the same
+ * distances, goals and unreachable cells marked, and every other cell
+ * pointing at a neighbor that is one step of its cost closer */
+static void check_flow(struct check *check, int range)
+{
+  unsigned int state = 4242;
+  for (int s = 0; s < N_SEARCH_SIZES; ++s) {
+    int w = search_sizes[s][0];
+    int h = search_sizes[s][1];
+    struct mmap map;
+    struct hex_flow flow;
+    unsigned int *dist = malloc(w * h * sizeof(*dist));
+    mmap_init(&map, w, h, 0);
+    hex_flow_init(&flow, w, h);
+    for (int c = 0; c < N_SEARCH_COSTS; ++c) {
+      const int *cost = search_costs[c];
+      for (int t = 0; t < 3; ++t) {
+        hex_flow_set_cost(&flow, t, cost[t]);
+      }
+      for (int q = 0; q <= range / 4; ++q) {
+        struct map_ipos goals[3];
+        int n_goals = 1 + q % 3;
+        random_tiles(&map, &state);
+        for (int i = 0; i < n_goals; ++i) {
+          goals[i].x = check_rand(&state) % w;
+          goals[i].y = check_rand(&state) % h;
+        }
+        brute_dist(&map, cost, goals, n_goals, dist);
+        hex_flow_build(&flow, &map, goals, n_goals, 1 + q % 4);
+        for (int y = 0; y < h; ++y) {
+          for (int x = 0; x < w; ++x) {
+            int cell = x + y * w;
+            int dir = flow.dir[cell];
+            int failed = flow.dist[cell] != dist[cell];
+            if (dist[cell] == UINT_MAX) {
+              failed |= dir != HEX_FLOW_NONE;
+            } else if (dist[cell] == 0) {
+              failed |= dir != HEX_FLOW_GOAL;
+            } else if (dir >= HEX_DIRECTIONS) {
+              failed = 1;
+            } else {
+              int nx = x + map_directions[dir].x;
+              int ny = y + map_directions[dir].y;
+              map_normalize_coordinates(&map, &nx, &ny);
+              failed |= dist[nx + ny * w] + cost[mmap_get(&map, nx, ny)]
+                != dist[cell];
+            }
+            check->tested++;
+            check->failed += failed;
+          }
+        }
+      }
+    }
+    hex_flow_free(&flow);
+    mmap_free(&map);
+    free(dist);
+  }
+}
+
+struct check_def {
+  const char *name;
+  void (*run)(struct check *check, int range);
+};
+
+static struct check_def check_defs[] = {
+  {"map_round_trip", check_map_round_trip},
+  {"map_round_i", check_map_round},
+  {"screen2map_i", check_screen_int},
+  {"screen2map_i_batch", check_screen_batch},
+  {"screen2map_i_lut", check_screen_lut},
+  {"hex_layout", check_layout},
+  {"hex_layout_other", check_layouts},
+  {"hex_iter", check_iter},
+  {"hex_los", check_los},
+  {"hex_line", check_line},
+  {"hex_fov", check_fov},
+  {"hex_path", check_path},
+  {"hex_flow", check_flow},
+};
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-n ops] [-r reps] [-w warmup] [-c range] "
+      "[-f text|csv|json]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  int ops = 1 << 22;
+  int reps = 7;
+  int warmup = 2;
+  int range = 64;
+  enum format format = FORMAT_TEXT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:w:c:f:h")) != -1) {
+    switch (opt) {
+      case 'n': ops = atoi(optarg); break;
+      case 'r': reps = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 'c': range = atoi(optarg); break;
+      case 'f':
+        if (!strcmp(optarg, "csv")) {
+          format = FORMAT_CSV;
+        } else if (!strcmp(optarg, "json")) {
+          format = FORMAT_JSON;
+        } else if (!strcmp(optarg, "text")) {
+          format = FORMAT_TEXT;
+        } else {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (ops < 1 || reps < 1 || warmup < 0 || range < 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  fill_inputs();
+  hex_layout_init(&layout_20x16, 20, 16, HEX_POINTY);
+
+  int n_benches = sizeof(benches) / sizeof(*benches);
+  int n_checks = sizeof(check_defs) / sizeof(*check_defs);
+  struct check checks[n_checks];
+  int failed = 0;
+  for (int i = 0; i < n_checks; ++i) {
+    checks[i].name = check_defs[i].name;
+    checks[i].tested = 0;
+    checks[i].failed = 0;
+    check_defs[i].run(&checks[i], range);
+    failed |= checks[i].failed != 0;
+  }
+
+  if (format == FORMAT_CSV) {
+    puts("kind,name,ns_per_op,mops_per_s,ops,reps,tested,failed");
+  } else if (format == FORMAT_JSON) {
+    printf("{\n  \"ops\": %d,\n  \"reps\": %d,\n  \"warmup\": %d,\n"
+        "  \"benchmarks\": [\n", ops, reps, warmup);
+  } else {
+    printf("%-24s %10s %10s\n", "benchmark", "ns/op", "Mops/s");
+  }
+
+  for (int i = 0; i < n_benches; ++i) {
+    double ns = bench_run(&benches[i], ops, reps, warmup);
+    double mops = 1e3 / ns;
+    if (format == FORMAT_CSV) {
+      printf("bench,%s,%.3f,%.2f,%d,%d,,\n", benches[i].name, ns, mops, ops, reps);
+    } else if (format == FORMAT_JSON) {
+      printf("    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"mops_per_s\": %.2f}%s\n",
+          benches[i].name, ns, mops, i + 1 < n_benches ? "," : "");
+    } else {
+      printf("%-24s %10.3f %10.2f\n", benches[i].name, ns, mops);
+    }
+  }
+
+  if (format == FORMAT_JSON) {
+    printf("  ],\n  \"checks\": [\n");
+  } else if (format == FORMAT_TEXT) {
+    printf("\n%-24s %10s %10s\n", "check", "tested", "failed");
+  }
+  for (int i = 0; i < n_checks; ++i) {
+    if (format == FORMAT_CSV) {
+      printf("check,%s,,,,,%ld,%ld\n", checks[i].name, checks[i].tested,
+          checks[i].failed);
+    } else if (format == FORMAT_JSON) {
+      printf("    {\"name\": \"%s\", \"tested\": %ld, \"failed\": %ld}%s\n",
+          checks[i].name, checks[i].tested, checks[i].failed,
+          i + 1 < n_checks ? "," : "");
+    } else {
+      printf("%-24s %10ld %10ld\n", checks[i].name, checks[i].tested,
+          checks[i].failed);
+    }
+  }
+  if (format == FORMAT_JSON) {
+    printf("  ],\n  \"ok\": %s\n}\n", failed ? "false" : "true");
+  }
+
+  hex_layout_free(&layout_20x16);
+  return failed ? 1 : 0;
+}
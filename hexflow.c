@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "hexflow.h"
+#include "jobs.h"
+
+/* parallel Dijkstra map
+ *
+ * the map rows are split into one band per thread and every band runs
+ * Dijkstra with its own heap over its own rows. a step into the row
+ * above or below the band is not taken but sent to the band owning it:
+ * each band has an outbox per side holding the best cost found for every
+ * cell of that row. bands work in rounds, a round first takes the
+ * outboxes the neighbors filled in the round before, then runs the heap
+ * dry and fills its own outboxes. outboxes are double buffered by round,
+ * so nobody reads what is being written, and only costs better than the
+ * ones sent before go out. the rounds end when nothing was sent.
+ *
+ * distances only go down and end up as the shortest ones, so directions
+ * picked from them in a last pass do not depend on the number of
+ * threads. */
+
+#define FLOW_UNREACHED UINT_MAX
+#define FLOW_MAX_BANDS 64
+#define SIDE_UP 0
+#define SIDE_DOWN 1
+
+struct flow_band {
+  int y_start;
+  int y_end;
+  /* the band's slice of the heap arrays */
+  int *heap;
+  int heap_size;
+  /* out[parity][side][x], sent[side][x] the best cost sent so far */
+  unsigned int *out[2][2];
+  int has_out[2][2];
+  unsigned int *sent[2];
+};
+
+struct flow_ctx {
+  struct hex_flow *flow;
+  struct mmap *map;
+  int bands;
+  int band_rows;
+  int round;
+  int *heap_pos;
+  struct flow_band band[FLOW_MAX_BANDS];
+};
+
+void hex_flow_init(struct hex_flow *flow, int w, int h)
+{
+  flow->w = w;
+  flow->h = h;
+  flow->dir = malloc(w * h * sizeof(*flow->dir));
+  flow->dist = malloc(w * h * sizeof(*flow->dist));
+  flow->step = malloc(w * h * sizeof(*flow->step));
+  for (int i = 0; i < HEX_FLOW_TILE_TYPES; ++i) {
+    flow->tile_cost[i] = 1;
+  }
+}
+
+void hex_flow_free(struct hex_flow *flow)
+{
+  free(flow->dir);
+  free(flow->dist);
+  free(flow->step);
+}
+
+void hex_flow_set_cost(struct hex_flow *flow, int tile, int cost)
+{
+  if (tile < 0 || tile >= HEX_FLOW_TILE_TYPES) {
+    return;
+  }
+  flow->tile_cost[tile] = cost;
+}
+
+static int neighbor(struct hex_flow *flow, int x, int y, int dir)
+{
+  int nx = x + map_directions[dir].x;
+  int ny = y + map_directions[dir].y;
+  if (nx < 0 || nx >= flow->w || ny < 0 || ny >= flow->h) {
+    struct mmap size = {.w = flow->w, .h = flow->h};
+    map_normalize_coordinates(&size, &nx, &ny);
+  }
+  return nx + ny * flow->w;
+}
+
+/* rows y_start .. y_end - 1 of a band, the last band takes the rest */
+static void band_rows(struct flow_ctx *ctx, int band, int *y_start, int *y_end)
+{
+  *y_start = band * ctx->band_rows;
+  *y_end = *y_start + ctx->band_rows;
+  if (band == ctx->bands - 1) {
+    *y_end = ctx->flow->h;
+  }
+}
+
+static void step_job(void *data, int band)
+{
+  struct flow_ctx *ctx = data;
+  struct hex_flow *flow = ctx->flow;
+  int y_start, y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  for (int y = y_start; y < y_end; ++y) {
+    for (int x = 0; x < flow->w; ++x) {
+      int tile = mmap_get(ctx->map, x, y);
+      int cost = HEX_FLOW_BLOCKED;
+      if (tile >= 0 && tile < HEX_FLOW_TILE_TYPES) {
+        cost = flow->tile_cost[tile];
+      }
+      flow->step[x + y * flow->w] = cost;
+      flow->dist[x + y * flow->w] = FLOW_UNREACHED;
+    }
+  }
+}
+
+static int heap_less(struct hex_flow *flow, int *heap, int a, int b)
+{
+  return flow->dist[heap[a]] < flow->dist[heap[b]];
+}
+
+static void heap_swap(struct flow_ctx *ctx, int *heap, int a, int b)
+{
+  int cell = heap[a];
+  heap[a] = heap[b];
+  heap[b] = cell;
+  ctx->heap_pos[heap[a]] = a;
+  ctx->heap_pos[heap[b]] = b;
+}
+
+static void heap_up(struct flow_ctx *ctx, struct flow_band *band, int i)
+{
+  while (i > 0 && heap_less(ctx->flow, band->heap, i, (i - 1) / 2)) {
+    heap_swap(ctx, band->heap, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static int heap_pop(struct flow_ctx *ctx, struct flow_band *band)
+{
+  int *heap = band->heap;
+  int top = heap[0];
+  ctx->heap_pos[top] = -1;
+  if (--band->heap_size) {
+    heap[0] = heap[band->heap_size];
+    ctx->heap_pos[heap[0]] = 0;
+    int i = 0;
+    for (;;) {
+      int child = 2 * i + 1;
+      if (child >= band->heap_size) {
+        break;
+      }
+      if (child + 1 < band->heap_size && heap_less(ctx->flow, heap, child + 1, child)) {
+        ++child;
+      }
+      if (!heap_less(ctx->flow, heap, child, i)) {
+        break;
+      }
+      heap_swap(ctx, heap, i, child);
+      i = child;
+    }
+  }
+  return top;
+}
+
+/* lowers the distance of a cell of the band and queues it */
+static void improve(struct flow_ctx *ctx, struct flow_band *band, int cell,
+    unsigned int d)
+{
+  ctx->flow->dist[cell] = d;
+  if (ctx->heap_pos[cell] < 0) {
+    band->heap[band->heap_size] = cell;
+    ctx->heap_pos[cell] = band->heap_size++;
+  }
+  heap_up(ctx, band, ctx->heap_pos[cell]);
+}
+
+/* takes what the band of row y sent for it in the last round */
+static void receive(struct flow_ctx *ctx, struct flow_band *band,
+    struct flow_band *from, int side, int y)
+{
+  int parity = (ctx->round - 1) & 1;
+  if (!from->has_out[parity][side]) {
+    return;
+  }
+  struct hex_flow *flow = ctx->flow;
+  unsigned int *in = from->out[parity][side];
+  for (int x = 0; x < flow->w; ++x) {
+    if (in[x] < flow->dist[x + y * flow->w]) {
+      improve(ctx, band, x + y * flow->w, in[x]);
+    }
+  }
+}
+
+static void band_job(void *data, int b)
+{
+  struct flow_ctx *ctx = data;
+  struct hex_flow *flow = ctx->flow;
+  struct flow_band *band = &ctx->band[b];
+  int parity = ctx->round & 1;
+  for (int side = 0; side < 2; ++side) {
+    if (band->has_out[parity][side]) {
+      for (int x = 0; x < flow->w; ++x) {
+        band->out[parity][side][x] = FLOW_UNREACHED;
+      }
+      band->has_out[parity][side] = 0;
+    }
+  }
+  if (!ctx->round) {
+    for (int cell = band->y_start * flow->w; cell < band->y_end * flow->w; ++cell) {
+      if (flow->dist[cell] == 0) {
+        improve(ctx, band, cell, 0);
+      }
+    }
+  } else {
+    /* the band above sends its down side, the one below its up side */
+    receive(ctx, band, &ctx->band[(b + ctx->bands - 1) % ctx->bands],
+        SIDE_DOWN, band->y_start);
+    receive(ctx, band, &ctx->band[(b + 1) % ctx->bands],
+        SIDE_UP, band->y_end - 1);
+  }
+
+  while (band->heap_size) {
+    int cell = heap_pop(ctx, band);
+    int x = cell % flow->w;
+    int y = cell / flow->w;
+    /* the neighbors step onto cell, a blocked goal can not be reached */
+    if (flow->step[cell] < 0) {
+      continue;
+    }
+    unsigned int d = flow->dist[cell] + flow->step[cell];
+    for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+      int next = neighbor(flow, x, y, dir);
+      if (flow->step[next] < 0) {
+        continue;
+      }
+      int ny = next / flow->w;
+      if (ny >= band->y_start && ny < band->y_end) {
+        if (d < flow->dist[next]) {
+          improve(ctx, band, next, d);
+        }
+        continue;
+      }
+      int side = map_directions[dir].y < 0 ? SIDE_UP : SIDE_DOWN;
+      int nx = next % flow->w;
+      if (d < band->sent[side][nx]) {
+        band->sent[side][nx] = d;
+        band->out[parity][side][nx] = d;
+        band->has_out[parity][side] = 1;
+      }
+    }
+  }
+}
+
+/* another round as long as some band sent something */
+static int next_round(void *data)
+{
+  struct flow_ctx *ctx = data;
+  int parity = ctx->round & 1;
+  int sent = 0;
+  for (int b = 0; b < ctx->bands; ++b) {
+    sent |= ctx->band[b].has_out[parity][SIDE_UP]
+        | ctx->band[b].has_out[parity][SIDE_DOWN];
+  }
+  ++ctx->round;
+  return sent;
+}
+
+static void dir_job(void *data, int band)
+{
+  struct flow_ctx *ctx = data;
+  struct hex_flow *flow = ctx->flow;
+  int y_start, y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  for (int y = y_start; y < y_end; ++y) {
+    for (int x = 0; x < flow->w; ++x) {
+      int cell = x + y * flow->w;
+      unsigned int d = flow->dist[cell];
+      flow->dir[cell] = HEX_FLOW_NONE;
+      if (d == 0) {
+        flow->dir[cell] = HEX_FLOW_GOAL;
+        continue;
+      }
+      if (d == FLOW_UNREACHED) {
+        continue;
+      }
+      for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+        int next = neighbor(flow, x, y, dir);
+        if (flow->dist[next] != FLOW_UNREACHED && flow->step[next] >= 0
+            && flow->dist[next] + flow->step[next] == d) {
+          flow->dir[cell] = dir;
+          break;
+        }
+      }
+    }
+  }
+}
+
+/* builds the flow field towards the nearest of goals. stepping onto a
+ * cell costs the tile cost of that cell (see hex_flow_set_cost(), negative
+ * costs block), like hex_path_find(). */
+void hex_flow_build(struct hex_flow *flow, struct mmap *map,
+    struct map_ipos *goals, int n_goals, int threads)
+{
+  struct flow_ctx ctx;
+  ctx.flow = flow;
+  ctx.map = map;
+  ctx.round = 0;
+  ctx.bands = threads < 1 ? 1 : threads;
+  if (ctx.bands > FLOW_MAX_BANDS) {
+    ctx.bands = FLOW_MAX_BANDS;
+  }
+  if (ctx.bands > flow->h) {
+    ctx.bands = flow->h;
+  }
+  ctx.band_rows = flow->h / ctx.bands;
+  int w = flow->w;
+  int *heap = malloc(w * flow->h * sizeof(*heap));
+  unsigned int *boxes = malloc(6 * ctx.bands * w * sizeof(*boxes));
+  ctx.heap_pos = malloc(w * flow->h * sizeof(*ctx.heap_pos));
+  for (int i = 0; i < w * flow->h; ++i) {
+    ctx.heap_pos[i] = -1;
+  }
+  for (int i = 0; i < 6 * ctx.bands * w; ++i) {
+    boxes[i] = FLOW_UNREACHED;
+  }
+  for (int b = 0; b < ctx.bands; ++b) {
+    struct flow_band *band = &ctx.band[b];
+    unsigned int *box = boxes + 6 * b * w;
+    band_rows(&ctx, b, &band->y_start, &band->y_end);
+    band->heap = heap + band->y_start * w;
+    band->heap_size = 0;
+    for (int i = 0; i < 4; ++i) {
+      band->out[i / 2][i % 2] = box + i * w;
+      band->has_out[i / 2][i % 2] = 0;
+    }
+    band->sent[SIDE_UP] = box + 4 * w;
+    band->sent[SIDE_DOWN] = box + 5 * w;
+  }
+
+  jobs_run(threads, ctx.bands, step_job, &ctx);
+  for (int i = 0; i < n_goals; ++i) {
+    struct map_ipos pos = goals[i];
+    map_normalize_coordinates(map, &pos.x, &pos.y);
+    flow->dist[pos.x + pos.y * flow->w] = 0;
+  }
+  jobs_run_rounds(threads, ctx.bands, band_job, next_round, &ctx);
+  jobs_run(threads, ctx.bands, dir_job, &ctx);
+  free(ctx.heap_pos);
+  free(boxes);
+  free(heap);
+}
+
+int hex_flow_dir(struct hex_flow *flow, struct mmap *map, int x, int y)
+{
+  map_normalize_coordinates(map, &x, &y);
+  return flow->dir[x + y * flow->w];
+}
@@ -0,0 +1,35 @@
+#ifndef HEXFLOW_H
+#define HEXFLOW_H
+
+#include "hex.h"
+#include "mmap.h"
+
+#define HEX_FLOW_TILE_TYPES 256
+#define HEX_FLOW_BLOCKED -1
+
+/* values of dir besides the directions 0 .. HEX_DIRECTIONS - 1 */
+#define HEX_FLOW_GOAL 6
+#define HEX_FLOW_NONE 255
+
+/* flow field towards a set of goals, see hex_flow_build().
+ * dir holds one byte per map cell (y * w + x, normalized map
+ * coordinates): the map_directions index of the next step, HEX_FLOW_GOAL
+ * on a goal and HEX_FLOW_NONE where no goal can be reached. dist holds
+ * the cost to the nearest goal. */
+struct hex_flow {
+  int w;
+  int h;
+  unsigned char *dir;
+  unsigned int *dist;
+  int *step;
+  int tile_cost[HEX_FLOW_TILE_TYPES];
+};
+
+void hex_flow_init(struct hex_flow *flow, int w, int h);
+void hex_flow_free(struct hex_flow *flow);
+void hex_flow_set_cost(struct hex_flow *flow, int tile, int cost);
+void hex_flow_build(struct hex_flow *flow, struct mmap *map,
+    struct map_ipos *goals, int n_goals, int threads);
+int hex_flow_dir(struct hex_flow *flow, struct mmap *map, int x, int y);
+
+#endif
@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hexfov.h"
+
+/* shadowcasting on hex sectors
+ *
+ * the cells around the origin are split into six sectors. cell i of ring
+ * d in sector s is origin + d * dir[s] + i * dir[s + 2], and covers the
+ * angles (i - 0.5) / d to (i + 0.5) / d of its sector. every sector keeps a
+ * sorted list of shadow intervals; a cell is visible unless its whole span
+ * is in shadow, and visible opaque cells add their span to the list once
+ * the ring is done. the corner cells i == d belong to two sectors. */
+
+static int words(int bits)
+{
+  return (bits + 31) / 32;
+}
+
+static int wrap(int v, int side)
+{
+  v %= side;
+  return v < 0 ? v + side : v;
+}
+
+/* opacity is cached by absolute position modulo side, so the cache does
+ * not have to move when the origin does */
+static int cache_index(struct hex_fov *fov, int x, int y)
+{
+  return wrap(x, fov->side) + wrap(y, fov->side) * fov->side;
+}
+
+static int local_index(struct hex_fov *fov, int x, int y)
+{
+  return (x - fov->origin.x + fov->radius)
+    + (y - fov->origin.y + fov->radius) * fov->side;
+}
+
+static int bit_get(uint32_t *bits, int i)
+{
+  return (bits[i >> 5] >> (i & 31)) & 1;
+}
+
+static void bit_put(uint32_t *bits, int i, int v)
+{
+  if (v) {
+    bits[i >> 5] |= 1u << (i & 31);
+  } else {
+    bits[i >> 5] &= ~(1u << (i & 31));
+  }
+}
+
+void hex_fov_init(struct hex_fov *fov, int radius)
+{
+  fov->radius = radius;
+  fov->side = 2 * radius + 1;
+  fov->origin.x = 0;
+  fov->origin.y = 0;
+  fov->valid = 0;
+  fov->visible = calloc(words(fov->side * fov->side), sizeof(*fov->visible));
+  fov->opaque = calloc(words(fov->side * fov->side), sizeof(*fov->opaque));
+  /* a sector never has more disjoint shadows than cells */
+  fov->shadows = malloc(2 * ((radius + 1) * (radius + 2) / 2 + 1)
+      * sizeof(*fov->shadows));
+  fov->ring = malloc((radius + 1) * sizeof(*fov->ring));
+}
+
+void hex_fov_free(struct hex_fov *fov)
+{
+  free(fov->visible);
+  free(fov->opaque);
+  free(fov->shadows);
+  free(fov->ring);
+}
+
+void hex_fov_invalidate(struct hex_fov *fov)
+{
+  fov->valid = 0;
+}
+
+static void cache_cell(struct hex_fov *fov, int x, int y,
+    hex_blocked_cb opaque, void *data)
+{
+  bit_put(fov->opaque, cache_index(fov, x, y), opaque(data, x, y));
+}
+
+static void cache_fill(struct hex_fov *fov, struct map_ipos *origin,
+    struct map_ipos *old_origin, hex_blocked_cb opaque, void *data)
+{
+  int r = fov->radius;
+  for (int dy = -r; dy <= r; ++dy) {
+    int dx_start = dy < 0 ? -dy - r : -r;
+    int dx_end = dy < 0 ? r : r - dy;
+    for (int dx = dx_start; dx <= dx_end; ++dx) {
+      struct map_ipos pos = {origin->x + dx, origin->y + dy};
+      if (old_origin && map_distance_i(&pos, old_origin) <= r) {
+        continue;
+      }
+      cache_cell(fov, pos.x, pos.y, opaque, data);
+    }
+  }
+}
+
+static int shadow_covers(float *shadows, int n, float lo, float hi)
+{
+  for (int i = 0; i < n; ++i) {
+    if (shadows[2 * i] > lo) {
+      return 0;
+    }
+    if (shadows[2 * i + 1] >= hi) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int shadow_add(float *shadows, int n, float lo, float hi)
+{
+  int first = 0;
+  while (first < n && shadows[2 * first + 1] < lo) {
+    ++first;
+  }
+  int last = first;
+  while (last < n && shadows[2 * last] <= hi) {
+    if (shadows[2 * last] < lo) {
+      lo = shadows[2 * last];
+    }
+    if (shadows[2 * last + 1] > hi) {
+      hi = shadows[2 * last + 1];
+    }
+    ++last;
+  }
+  /* replace shadows first..last - 1 by the merged one */
+  int removed = last - first;
+  memmove(&shadows[2 * (first + 1)], &shadows[2 * last],
+      2 * (n - last) * sizeof(*shadows));
+  shadows[2 * first] = lo;
+  shadows[2 * first + 1] = hi;
+  return n - removed + 1;
+}
+
+static void cast_sector(struct hex_fov *fov, int sector)
+{
+  const struct map_ipos *out = &map_directions[sector];
+  const struct map_ipos *along = &map_directions[(sector + 2) % HEX_DIRECTIONS];
+  int n_shadows = 0;
+
+  for (int d = 1; d <= fov->radius; ++d) {
+    int n_ring = 0;
+    for (int i = 0; i <= d; ++i) {
+      float lo = (i - 0.5f) / d;
+      float hi = (i + 0.5f) / d;
+      lo = lo < 0.0f ? 0.0f : lo;
+      hi = hi > 1.0f ? 1.0f : hi;
+      if (shadow_covers(fov->shadows, n_shadows, lo, hi)) {
+        continue;
+      }
+      int x = fov->origin.x + out->x * d + along->x * i;
+      int y = fov->origin.y + out->y * d + along->y * i;
+      bit_put(fov->visible, local_index(fov, x, y), 1);
+      if (bit_get(fov->opaque, cache_index(fov, x, y))) {
+        fov->ring[n_ring++] = i;
+      }
+    }
+    for (int k = 0; k < n_ring; ++k) {
+      float lo = (fov->ring[k] - 0.5f) / d;
+      float hi = (fov->ring[k] + 0.5f) / d;
+      n_shadows = shadow_add(fov->shadows, n_shadows,
+          lo < 0.0f ? 0.0f : lo, hi > 1.0f ? 1.0f : hi);
+    }
+    if (n_shadows == 1 && fov->shadows[0] <= 0.0f && fov->shadows[1] >= 1.0f) {
+      return;
+    }
+  }
+}
+
+static void cast(struct hex_fov *fov)
+{
+  memset(fov->visible, 0,
+      words(fov->side * fov->side) * sizeof(*fov->visible));
+  bit_put(fov->visible, local_index(fov, fov->origin.x, fov->origin.y), 1);
+  for (int sector = 0; sector < HEX_DIRECTIONS; ++sector) {
+    cast_sector(fov, sector);
+  }
+}
+
+void hex_fov_compute(struct hex_fov *fov, struct map_ipos *origin,
+    hex_blocked_cb opaque, void *data)
+{
+  fov->origin = *origin;
+  cache_fill(fov, origin, NULL, opaque, data);
+  fov->valid = 1;
+  cast(fov);
+}
+
+/* like hex_fov_compute(), but does nothing if the origin did not move
+ * since the last call, and only asks opaque() for the cells that came
+ * into range if it moved by one cell. call hex_fov_invalidate() after
+ * the map changed. */
+void hex_fov_update(struct hex_fov *fov, struct map_ipos *origin,
+    hex_blocked_cb opaque, void *data)
+{
+  if (fov->valid && origin->x == fov->origin.x && origin->y == fov->origin.y) {
+    return;
+  }
+  if (!fov->valid || map_distance_i(origin, &fov->origin) != 1) {
+    hex_fov_compute(fov, origin, opaque, data);
+    return;
+  }
+  struct map_ipos old_origin = fov->origin;
+  fov->origin = *origin;
+  cache_fill(fov, origin, &old_origin, opaque, data);
+  cast(fov);
+}
+
+int hex_fov_visible(struct hex_fov *fov, int x, int y)
+{
+  struct map_ipos pos = {x, y};
+  if (map_distance_i(&pos, &fov->origin) > fov->radius) {
+    return 0;
+  }
+  return bit_get(fov->visible, local_index(fov, x, y));
+}
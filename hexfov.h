@@ -0,0 +1,30 @@
+#ifndef HEXFOV_H
+#define HEXFOV_H
+
+#include <stdint.h>
+#include "hexlos.h"
+
+/* field of view around one origin, see hex_fov_update().
+ * visible holds one bit per cell of the (2 * radius + 1)^2 box around
+ * origin, opaque caches the opacity callback for the same cells. */
+struct hex_fov {
+  int radius;
+  int side;
+  struct map_ipos origin;
+  int valid;
+  uint32_t *visible;
+  uint32_t *opaque;
+  float *shadows;
+  int *ring;
+};
+
+void hex_fov_init(struct hex_fov *fov, int radius);
+void hex_fov_free(struct hex_fov *fov);
+void hex_fov_invalidate(struct hex_fov *fov);
+void hex_fov_compute(struct hex_fov *fov, struct map_ipos *origin,
+    hex_blocked_cb opaque, void *data);
+void hex_fov_update(struct hex_fov *fov, struct map_ipos *origin,
+    hex_blocked_cb opaque, void *data);
+int hex_fov_visible(struct hex_fov *fov, int x, int y);
+
+#endif
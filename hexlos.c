@@ -0,0 +1,90 @@
+#include "hexlos.h"
+
+/* lines handled together by hex_los_batch */
+#define LOS_BLOCK 64
+
+/* the cells between from and to are walked with the same points as
+ * map_line_i(), from and to themselves never block */
+int hex_los(struct map_ipos *from, struct map_ipos *to,
+    hex_blocked_cb blocked, void *data)
+{
+  struct map_ipos d_pos;
+  struct cube_ipos delta;
+  int n = map_distance_i(from, to);
+  map_sub_i(to, from, &d_pos);
+  map2cube_i(&d_pos, &delta);
+  for (int i = 1; i < n; ++i) {
+    struct cube_pos c_pos;
+    struct cube_ipos base;
+    struct cube_ipos r_pos;
+    struct map_ipos m_pos;
+    cube_line_point(&delta, i, n, &base, &c_pos);
+    cube_round_i(&c_pos, &r_pos);
+    cube_add_i(&base, &r_pos, &r_pos);
+    cube2map_i(&r_pos, &m_pos);
+    if (blocked(data, from->x + m_pos.x, from->y + m_pos.y)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* walks up to LOS_BLOCK lines in lock step: every round computes the next
+ * point of all lines still running and rounds them with one call to
+ * cube_round_i_batch(), which is vectorized. lines drop out as soon as
+ * they hit a blocking cell or reach their target. */
+int hex_los_batch(struct hex_los_query *queries, int n,
+    hex_blocked_cb blocked, void *data, unsigned char *visible)
+{
+  struct cube_ipos delta[LOS_BLOCK];
+  int length[LOS_BLOCK];
+  int active[LOS_BLOCK];
+  struct cube_ipos bases[LOS_BLOCK];
+  struct cube_pos points[LOS_BLOCK];
+  struct cube_ipos cells[LOS_BLOCK];
+  int count = 0;
+
+  for (int base = 0; base < n; base += LOS_BLOCK) {
+    int lines = n - base < LOS_BLOCK ? n - base : LOS_BLOCK;
+    int n_active = 0;
+    for (int i = 0; i < lines; ++i) {
+      struct hex_los_query *q = &queries[base + i];
+      struct map_ipos d_pos;
+      map_sub_i(&q->to, &q->from, &d_pos);
+      map2cube_i(&d_pos, &delta[i]);
+      length[i] = map_distance_i(&q->from, &q->to);
+      visible[base + i] = 1;
+      if (length[i] > 1) {
+        active[n_active++] = i;
+      }
+    }
+
+    for (int step = 1; n_active; ++step) {
+      for (int a = 0; a < n_active; ++a) {
+        int i = active[a];
+        cube_line_point(&delta[i], step, length[i], &bases[a], &points[a]);
+      }
+      cube_round_i_batch(points, cells, n_active);
+
+      int still_active = 0;
+      for (int a = 0; a < n_active; ++a) {
+        int i = active[a];
+        struct hex_los_query *q = &queries[base + i];
+        struct map_ipos m_pos;
+        cube_add_i(&bases[a], &cells[a], &cells[a]);
+        cube2map_i(&cells[a], &m_pos);
+        if (blocked(data, q->from.x + m_pos.x, q->from.y + m_pos.y)) {
+          visible[base + i] = 0;
+        } else if (step + 1 < length[i]) {
+          active[still_active++] = i;
+        }
+      }
+      n_active = still_active;
+    }
+
+    for (int i = 0; i < lines; ++i) {
+      count += visible[base + i];
+    }
+  }
+  return count;
+}
@@ -0,0 +1,19 @@
+#ifndef HEXLOS_H
+#define HEXLOS_H
+
+#include "hex.h"
+
+/* returns non zero if the map cell at x, y blocks the line of sight */
+typedef int (*hex_blocked_cb)(void *data, int x, int y);
+
+struct hex_los_query {
+  struct map_ipos from;
+  struct map_ipos to;
+};
+
+int hex_los(struct map_ipos *from, struct map_ipos *to,
+    hex_blocked_cb blocked, void *data);
+int hex_los_batch(struct hex_los_query *queries, int n,
+    hex_blocked_cb blocked, void *data, unsigned char *visible);
+
+#endif
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include "hexpath.h"
+
+/* A* over the cells of a struct mmap
+ *
+ * cells are numbered y * w + x in normalized map coordinates. the open
+ * list is a binary min heap of cell numbers ordered by cost + estimate
+ * (the heuristic, computed once per cell), and heap_pos gives the heap
+ * slot of every open cell so decrease-key is a sift up. flags holds the
+ * open/closed state and the direction the cell was entered from, which
+ * is all that is needed to walk the path back. */
+
+#define FLAG_OPEN 0x08
+#define FLAG_CLOSED 0x10
+#define FLAG_DIR 0x07
+
+void hex_path_init(struct hex_path *path, int w, int h)
+{
+  path->w = w;
+  path->h = h;
+  path->cost = malloc(w * h * sizeof(*path->cost));
+  path->estimate = malloc(w * h * sizeof(*path->estimate));
+  path->stamp = calloc(w * h, sizeof(*path->stamp));
+  path->flags = malloc(w * h * sizeof(*path->flags));
+  path->heap = malloc(w * h * sizeof(*path->heap));
+  path->heap_pos = malloc(w * h * sizeof(*path->heap_pos));
+  path->heap_size = 0;
+  path->generation = 0;
+  for (int i = 0; i < HEX_DIRECTIONS; ++i) {
+    path->neighbor_offset[i] = map_directions[i].x + map_directions[i].y * w;
+  }
+  for (int i = 0; i < HEX_PATH_TILE_TYPES; ++i) {
+    path->tile_cost[i] = 1;
+  }
+  path->min_cost = 1;
+}
+
+void hex_path_free(struct hex_path *path)
+{
+  free(path->cost);
+  free(path->estimate);
+  free(path->stamp);
+  free(path->flags);
+  free(path->heap);
+  free(path->heap_pos);
+}
+
+/* min_cost is the cheapest step of any tile that is not blocked, 0 if a
+ * tile is free. anything bigger would overestimate and lose paths. */
+void hex_path_set_cost(struct hex_path *path, int tile, int cost)
+{
+  if (tile < 0 || tile >= HEX_PATH_TILE_TYPES) {
+    return;
+  }
+  path->tile_cost[tile] = cost;
+  path->min_cost = -1;
+  for (int i = 0; i < HEX_PATH_TILE_TYPES; ++i) {
+    int c = path->tile_cost[i];
+    if (c >= 0 && (path->min_cost < 0 || c < path->min_cost)) {
+      path->min_cost = c;
+    }
+  }
+  if (path->min_cost < 0) {
+    path->min_cost = 0;
+  }
+}
+
+/* hex distance to the nearest copy of the goal on the wrapped map. the
+ * map repeats every w cells in x and every h cells in y with x shifted by
+ * -h / 2, see map_normalize_coordinates() */
+static int wrapped_distance(struct hex_path *path, int dx, int dy)
+{
+  int best = -1;
+  for (int j = -1; j <= 1; ++j) {
+    int y = dy + j * path->h;
+    int x = dx - j * (path->h / 2);
+    /* the distance is smallest around x = -y / 2 */
+    int k0 = -(x + y / 2) / path->w;
+    for (int k = k0 - 1; k <= k0 + 1; ++k) {
+      int kx = x + k * path->w;
+      int d = (abs(kx) + abs(y) + abs(kx + y)) / 2;
+      if (best < 0 || d < best) {
+        best = d;
+      }
+    }
+  }
+  return best;
+}
+
+static int heuristic(struct hex_path *path, int cell, struct map_ipos *goal)
+{
+  int x = cell % path->w;
+  int y = cell / path->w;
+  return wrapped_distance(path, goal->x - x, goal->y - y) * path->min_cost;
+}
+
+static int heap_key(struct hex_path *path, int i)
+{
+  int cell = path->heap[i];
+  return path->cost[cell] + path->estimate[cell];
+}
+
+static void heap_swap(struct hex_path *path, int a, int b)
+{
+  int cell = path->heap[a];
+  path->heap[a] = path->heap[b];
+  path->heap[b] = cell;
+  path->heap_pos[path->heap[a]] = a;
+  path->heap_pos[path->heap[b]] = b;
+}
+
+static void heap_up(struct hex_path *path, int i)
+{
+  int key = heap_key(path, i);
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (heap_key(path, parent) <= key) {
+      break;
+    }
+    heap_swap(path, i, parent);
+    i = parent;
+  }
+}
+
+static void heap_down(struct hex_path *path, int i)
+{
+  for (;;) {
+    int smallest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < path->heap_size
+        && heap_key(path, left) < heap_key(path, smallest)) {
+      smallest = left;
+    }
+    if (right < path->heap_size
+        && heap_key(path, right) < heap_key(path, smallest)) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    heap_swap(path, i, smallest);
+    i = smallest;
+  }
+}
+
+static int heap_pop(struct hex_path *path)
+{
+  int cell = path->heap[0];
+  --path->heap_size;
+  if (path->heap_size) {
+    path->heap[0] = path->heap[path->heap_size];
+    path->heap_pos[path->heap[0]] = 0;
+    heap_down(path, 0);
+  }
+  return cell;
+}
+
+static void heap_push(struct hex_path *path, int cell)
+{
+  int i = path->heap_size++;
+  path->heap[i] = cell;
+  path->heap_pos[cell] = i;
+  heap_up(path, i);
+}
+
+static int neighbor(struct hex_path *path, int cell, int x, int y, int dir)
+{
+  /* inner cells can use the precomputed offsets, border cells wrap */
+  if (x > 0 && x < path->w - 1 && y > 0 && y < path->h - 1) {
+    return cell + path->neighbor_offset[dir];
+  }
+  struct mmap size = {.w = path->w, .h = path->h};
+  int nx = x + map_directions[dir].x;
+  int ny = y + map_directions[dir].y;
+  map_normalize_coordinates(&size, &nx, &ny);
+  return nx + ny * path->w;
+}
+
+static int tile_cost(struct hex_path *path, struct mmap *map, int cell)
+{
+  int tile = mmap_get(map, cell % path->w, cell / path->w);
+  if (tile < 0 || tile >= HEX_PATH_TILE_TYPES) {
+    return HEX_PATH_BLOCKED;
+  }
+  return path->tile_cost[tile];
+}
+
+/* writes the path from start to goal, both included, to out and returns
+ * its length, or -1 if there is none. if the path is longer than max only
+ * its first max cells are written. positions are normalized. entering a
+ * cell costs the tile cost of that cell, tiles with a negative cost can
+ * not be entered. */
+int hex_path_find(struct hex_path *path, struct mmap *map,
+    struct map_ipos *start, struct map_ipos *goal,
+    struct map_ipos *out, int max)
+{
+  struct map_ipos from = *start;
+  struct map_ipos to = *goal;
+  map_normalize_coordinates(map, &from.x, &from.y);
+  map_normalize_coordinates(map, &to.x, &to.y);
+  int start_cell = from.x + from.y * path->w;
+  int goal_cell = to.x + to.y * path->w;
+
+  if (++path->generation == 0) {
+    /* stamps wrapped around, old stamps could look current again */
+    for (int i = 0; i < path->w * path->h; ++i) {
+      path->stamp[i] = 0;
+    }
+    path->generation = 1;
+  }
+  path->heap_size = 0;
+  path->stamp[start_cell] = path->generation;
+  path->cost[start_cell] = 0;
+  path->estimate[start_cell] = heuristic(path, start_cell, &to);
+  path->flags[start_cell] = FLAG_OPEN;
+  heap_push(path, start_cell);
+
+  while (path->heap_size) {
+    int cell = heap_pop(path);
+    if (cell == goal_cell) {
+      break;
+    }
+    path->flags[cell] = (path->flags[cell] & FLAG_DIR) | FLAG_CLOSED;
+    int x = cell % path->w;
+    int y = cell / path->w;
+    for (int dir = 0; dir < HEX_DIRECTIONS; ++dir) {
+      int next = neighbor(path, cell, x, y, dir);
+      int fresh = path->stamp[next] != path->generation;
+      if (!fresh && (path->flags[next] & FLAG_CLOSED)) {
+        continue;
+      }
+      int step = tile_cost(path, map, next);
+      if (step < 0) {
+        continue;
+      }
+      int cost = path->cost[cell] + step;
+      if (fresh) {
+        path->stamp[next] = path->generation;
+        path->cost[next] = cost;
+        path->estimate[next] = heuristic(path, next, &to);
+        path->flags[next] = FLAG_OPEN | dir;
+        heap_push(path, next);
+      } else if (cost < path->cost[next]) {
+        path->cost[next] = cost;
+        path->flags[next] = FLAG_OPEN | dir;
+        heap_up(path, path->heap_pos[next]);
+      }
+    }
+  }
+
+  if (path->stamp[goal_cell] != path->generation) {
+    return -1;
+  }
+
+  /* walk back from the goal, once to count and once to write */
+  int length = 1;
+  struct map_ipos pos = to;
+  while (pos.x != from.x || pos.y != from.y) {
+    int dir = path->flags[pos.x + pos.y * path->w] & FLAG_DIR;
+    pos.x -= map_directions[dir].x;
+    pos.y -= map_directions[dir].y;
+    map_normalize_coordinates(map, &pos.x, &pos.y);
+    ++length;
+  }
+  pos = to;
+  for (int i = length - 1; i >= 0; --i) {
+    if (i < max) {
+      out[i] = pos;
+    }
+    if (i) {
+      int dir = path->flags[pos.x + pos.y * path->w] & FLAG_DIR;
+      pos.x -= map_directions[dir].x;
+      pos.y -= map_directions[dir].y;
+      map_normalize_coordinates(map, &pos.x, &pos.y);
+    }
+  }
+  return length;
+}
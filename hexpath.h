@@ -0,0 +1,36 @@
+#ifndef HEXPATH_H
+#define HEXPATH_H
+
+#include "hex.h"
+#include "mmap.h"
+
+#define HEX_PATH_TILE_TYPES 256
+#define HEX_PATH_BLOCKED -1
+
+/* reusable A* search state for maps of one size, see hex_path_init().
+ * nothing is allocated or cleared per query: cells belong to the current
+ * search only if their stamp equals generation. */
+struct hex_path {
+  int w;
+  int h;
+  int *cost;
+  int *estimate;
+  unsigned int *stamp;
+  unsigned char *flags;
+  int *heap;
+  int *heap_pos;
+  int heap_size;
+  unsigned int generation;
+  int neighbor_offset[HEX_DIRECTIONS];
+  int tile_cost[HEX_PATH_TILE_TYPES];
+  int min_cost;
+};
+
+void hex_path_init(struct hex_path *path, int w, int h);
+void hex_path_free(struct hex_path *path);
+void hex_path_set_cost(struct hex_path *path, int tile, int cost);
+int hex_path_find(struct hex_path *path, struct mmap *map,
+    struct map_ipos *start, struct map_ipos *goal,
+    struct map_ipos *out, int max);
+
+#endif
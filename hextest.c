@@ -1,7 +1,13 @@
+#include <stdio.h>
 #include "engine.h"
 #include "hex.h"
 #include "hextile.h"
-#include "perlin_noise2d.h"
+#include "noise.h"
+#include "mmap.h"
+#include "mapfile.h"
+#include "mapgen.h"
+#include "jobs.h"
+#include "worldgen.h"
 
 int mouse_is_down = 0;
 struct map_pos center_pos = {0,0};
@@ -9,18 +15,21 @@ struct map_pos scroll_pos;
 struct screen_pos mouse_pos = {0,0};
 struct screen_pos current_mouse_pos = {0,0};
 struct tileset *glob_tiles = NULL;
+struct hex_layout glob_layout;
 
 static void init(void **data)
 {
   draw_color(0,0,0,255);
   text_color(150,150,150,255);
-  glob_tiles = tileset_load_raw_from_file("../hextile.png", WIDTH, HEIGHT);
+  hex_layout_init(&glob_layout, WIDTH, HEIGHT, HEX_POINTY);
+  glob_tiles = tileset_load_raw_from_file("../hextile.png",
+      glob_layout.width, glob_layout.height);
 }
 
 static void screen2map(struct screen_pos *s_pos, struct map_pos *m_pos)
 {
   struct cube_pos c_pos;
-  screen2cube(s_pos, &c_pos);
+  hex_layout_screen2cube(&glob_layout, s_pos, &c_pos);
   cube2map(&c_pos, m_pos);
 }
 
@@ -28,7 +37,7 @@ static void map2screen(struct map_pos *m_pos, struct screen_pos *s_pos)
 {
   struct cube_pos c_pos;
   map2cube(m_pos, &c_pos);
-  cube2screen(&c_pos, s_pos);
+  hex_layout_cube2screen(&glob_layout, &c_pos, s_pos);
 }
 
 static void update(void *data, float delta)
@@ -64,57 +73,75 @@ static void mouse_down(int button, int x, int y, void *data)
   mouse_pos.y = y;
 }
 
-struct mmap {
-  int w;
-  int h;
-  int *data;
-};
+/* bump when worldgen changes what it makes of the same params, the
+ * saved maps of the old version are not used then */
+#define MAP_GEN_VERSION 1
 
-static void mmap_init(struct mmap *map, int w, int h, int v)
+/* fnv-1a of the bytes of an object */
+static unsigned hash_bytes(unsigned hash, const void *data, size_t size)
 {
-  map->w = w;
-  map->h = h;
-  map->data = malloc(w * h * sizeof(*map->data));
-  for (int i = 0; i < w * h; ++i) {
-    map->data[i] = v;
+  const unsigned char *p = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 16777619u;
   }
+  return hash;
 }
 
-static void mmap_set(struct mmap* map, int x, int y, int v)
+/* runs on the mapgen worker. maps made before with the same params and
+ * generator version come from their file. */
+static int make_map(struct mmap *map, int seed, struct worldgen_status *status,
+    void *data)
 {
-  while (y < 0) {
-    y += map->h;
+  int MAP_W = 128;
+  int MAP_H = 128;
+  struct noise_octave octaves[] = {
+    {64, 0.7}, {32, 0.6}, {16, 0.4}, {8, 0.3}, {4, 0.2}
+  };
+  struct noise_params noise = {
+    NOISE_PERLIN, octaves, sizeof(octaves) / sizeof(*octaves), seed
+  };
+  /* fractions of the map, about what {.6, .9} on the normalized noise
+   * gave on average */
+  static const double limits[] = {.75, .998};
+  struct worldgen_params params = {&noise, limits, 2, 8, 1, status};
+
+  unsigned hash = 2166136261u;
+  hash = hash_bytes(hash, &noise.type, sizeof(noise.type));
+  for (int i = 0; i < noise.n_octaves; ++i) {
+    hash = hash_bytes(hash, &octaves[i].divisor, sizeof(octaves[i].divisor));
+    hash = hash_bytes(hash, &octaves[i].weight, sizeof(octaves[i].weight));
   }
-  x -= y / 2;
-  while (x < 0) {
-    x += map->w;
+  hash = hash_bytes(hash, limits, sizeof(limits));
+  hash = hash_bytes(hash, &params.n_limits, sizeof(params.n_limits));
+  hash = hash_bytes(hash, &params.sample_step, sizeof(params.sample_step));
+  hash = hash_bytes(hash, &params.percentiles, sizeof(params.percentiles));
+  char path[64];
+  snprintf(path, sizeof(path), "hexmap-v%d-%dx%d-%08x-%d.map",
+      MAP_GEN_VERSION, MAP_W, MAP_H, hash, seed);
+  if (!mapfile_open(map, path, 0)) {
+    return 0;
   }
-  map->data[(y%map->h) * map->w + (x%map->w)] = v;
-}
-
-static int mmap_get(struct mmap* map, int x, int y)
-{
-  return map->data[map->w * y + (x % map->w)];
+  mmap_init(map, MAP_W, MAP_H, 0);
+  if (worldgen_generate(map, &params, jobs_cpu_count())) {
+    mmap_free(map);
+    return -1;
+  }
+  /* the map is fine without its file, it is made again next time */
+  if (mapfile_save(map, path)) {
+    fprintf(stderr, "can not save %s\n", path);
+    remove(path);
+  }
+  return 0;
 }
 
-static void map_normalize_coordinates(struct mmap* map, int *x_par, int *y_par)
+static void draw_progress(struct mapgen *gen, int x, int y)
 {
-  int x = *x_par;
-  int y = *y_par;
-  while (y < 0) {
-    y += map->h;
-    x -= map->h / 2;
-  }
-  while (y >= map->h) {
-    y -= map->h;
-    x += map->h/ 2;
+  float progress = mapgen_progress(gen);
+  if (progress < 1) {
+    char text[32];
+    snprintf(text, sizeof(text), "generating %d%%", (int)(progress * 100));
+    draw_text(x + 4, y + 4, text);
   }
-  while (x < 0) {
-    x += map->w;
-  }
-  x %= map->w;
-  *x_par = x;
-  *y_par = y;
 }
 
 static void draw_map_test(int seed, int x, int y, int w, int h, struct map_pos *center)
@@ -124,81 +151,37 @@ static void draw_map_test(int seed, int x, int y, int w, int h, struct map_pos *
   int clip_center_y = h / 2;
 
   /* print position of center tile */
-  int center_x = clip_center_x - WIDTH / 2;
-  int center_y = clip_center_y - HEIGHT / 2;
+  int center_x = clip_center_x - glob_layout.width / 2;
+  int center_y = clip_center_y - glob_layout.height / 2;
 
   /* XXX initialize global map ... 
-   * normally this does not belong in here */
-  static struct mmap glob_map = {0};
+   * normally this does not belong in here. the map is made in the
+   * background, until it is done the last one is drawn. */
+  static struct mapgen glob_gen;
+  static int started = 0;
   static int last_seed = 0;
-  if (!glob_map.w || last_seed != seed) {
-    srand(seed);
-    last_seed = seed;
-    int MAP_W = 128;
-    int MAP_H = 128;
-    float perlin_noise_a[MAP_W * MAP_H];
-    float perlin_noise_b[MAP_W * MAP_H];
-    float perlin_noise_c[MAP_W * MAP_H];
-    float perlin_noise_d[MAP_W * MAP_H];
-    float perlin_noise_e[MAP_W * MAP_H];
-    float perlin_noise_result[MAP_W * MAP_H];
-    perlin_noise2d(MAP_W, MAP_H, 64, perlin_noise_a);
-    perlin_noise2d(MAP_W, MAP_H, 32, perlin_noise_b);
-    perlin_noise2d(MAP_W, MAP_H, 16, perlin_noise_c);
-    perlin_noise2d(MAP_W, MAP_H, 8, perlin_noise_d);
-    perlin_noise2d(MAP_W, MAP_H, 4, perlin_noise_e);
-    if (!glob_map.w) {
-      mmap_init(&glob_map, MAP_W, MAP_H, 0);
+  if (!started || last_seed != seed) {
+    if (!started) {
+      mapgen_init(&glob_gen, make_map, NULL);
+      started = 1;
     }
-    int p = 0;
-    float biggest = 0;
-    float smalest = 0;
-    for (p = 0; p < MAP_W * MAP_H; ++p) {
-      float perlin_noise = perlin_noise_a[p] * 0.7;
-      perlin_noise += perlin_noise_b[p] * 0.6;
-      perlin_noise += perlin_noise_c[p] * 0.4;
-      perlin_noise += perlin_noise_d[p] * 0.3;
-      perlin_noise += perlin_noise_e[p] * 0.2;
-      if (perlin_noise < smalest) {
-        smalest = perlin_noise;
-      } else if (perlin_noise > biggest) {
-        biggest = perlin_noise;
-      }
-      perlin_noise_result[p] = perlin_noise;
-    }
-    smalest = fabs(smalest);
-    p = 0;
-    for (int init_y = 0; init_y < MAP_H; ++init_y) {
-      for (int init_x = 0; init_x < MAP_W; ++init_x) {
-        if (perlin_noise_result[p] < 0.0) {
-          perlin_noise_result[p] /= smalest;
-        } else {
-          perlin_noise_result[p] /= biggest;
-        }
-
-        float n = (perlin_noise_result[p] + 1.0) / 2.0;
-        if (n < .6) {
-          mmap_set(&glob_map, init_x, init_y, 0);
-        } else if (n < 0.90) {
-          mmap_set(&glob_map, init_x, init_y, 1);
-        } else {
-          mmap_set(&glob_map, init_x, init_y, 2);
-        }
-      ++p;
-      }
-    }
-    //mmap_set(&glob_map, 0, 0, 1);
-    //mmap_set(&glob_map, 0, 1, 1);
+    last_seed = seed;
+    mapgen_request(&glob_gen, seed);
+  }
+  /* this is the start of the frame, nothing of the old map is in use */
+  struct mmap *glob_map = mapgen_swap(&glob_gen);
+  if (!glob_map) {
+    draw_progress(&glob_gen, x, y);
+    return;
   }
   /* XXX */
 
 
-  struct map_pos r_pos;
-  r_pos = *center;
-  map_round(&r_pos);
+  struct map_ipos r_pos;
+  map_round_i(center, &r_pos);
 
   struct screen_pos round;
-  map2screen(&r_pos, &round);
+  hex_layout_map2screen_i(&glob_layout, &r_pos, &round);
 
   struct screen_pos screen;
   map2screen(center, &screen);
@@ -214,63 +197,57 @@ static void draw_map_test(int seed, int x, int y, int w, int h, struct map_pos *
   center_y += soft_scroll_screen_offset_y;
 
 
-  int W = ceilf(w / (float)WIDTH) + 2;
-  int H = ceilf(h / (HEIGHT * 0.75)) + 2;
-
-  int off = 0;
-  int o2 = 0;
+  int W = ceilf(w / (float)glob_layout.width) + 2;
+  int H = ceilf(h / (glob_layout.height * 0.75)) + 2;
 
   struct screen_pos local_mouse_pos = current_mouse_pos;
   local_mouse_pos.x -= x + clip_center_x + soft_scroll_screen_offset_x;
   local_mouse_pos.y -= y + clip_center_y + soft_scroll_screen_offset_y;
 
-  struct cube_pos mouse_c_pos;
-  screen2cube(&local_mouse_pos, &mouse_c_pos);
-  cube_round(&mouse_c_pos);
-  struct map_pos mouse_map_pos;
-  cube2map(&mouse_c_pos, &mouse_map_pos);
-
-  mouse_map_pos.x -= r_pos.x;
-  mouse_map_pos.y -= r_pos.y;
+  struct map_ipos mouse_map_pos;
+  hex_layout_screen2map_i(&glob_layout, &local_mouse_pos, &mouse_map_pos);
 
-  /* convert to integer for map-normalization */
-  int mouse_map_x = mouse_map_pos.x;
-  int mouse_map_y = mouse_map_pos.y;
+  int mouse_map_x = mouse_map_pos.x - r_pos.x;
+  int mouse_map_y = mouse_map_pos.y - r_pos.y;
 
-  map_normalize_coordinates(&glob_map, &mouse_map_x, &mouse_map_y);
+  map_normalize_coordinates(glob_map, &mouse_map_x, &mouse_map_y);
 
 
   int offset = ceilf(H/4.0);
-  struct map_pos pos;
-  for (pos.y = -(ceilf(H/2.0)); pos.y < ceilf(H/2.0); ++pos.y) {
-    ++o2;
-    off = o2 / 2;
-    for (pos.x = -(ceilf(W/2.0)) + offset; pos.x < ceilf(W/2.0)+offset ; ++pos.x) {
-      /* align x offset */
-
-      pos.x -= off;
-
-      map2screen(&pos, &screen);
-      int map_x = pos.x - r_pos.x;
-      int map_y = pos.y - r_pos.y;
-      if (map_y >= 0 && map_y < glob_map.h) {
-        map_normalize_coordinates(&glob_map, &map_x, &map_y);
-        int tile = mmap_get(&glob_map, map_x, map_y);
-        draw_frame(x + center_x + screen.x, y + center_y + screen.y, tileset_get_frame_by_id(glob_tiles, tile));
-      }
-
-      if (map_x == mouse_map_x && map_y == mouse_map_y) {
-        // XXX dont draw mouse position for now
-        // draw_frame(x + center_x + screen.x, y + center_y + screen.y, tileset_get_frame_by_id(glob_tiles, 2));
-      }
-
-      /* reset x offset for for - loop */
-      pos.x += off;
+  int half_w = (W + 1) / 2;
+  int half_h = (H + 1) / 2;
+  /* row k from the top starts at map x -half_w + offset - (k + 1) / 2.
+   * in offset space the second row starts at the same x as the first when
+   * half_h is odd, else a cell to the left of it, and all later rows
+   * repeat these two. the rect starts at the second and is as much wider,
+   * so it covers both. */
+  struct map_ipos first = {-half_w + offset, -half_h};
+  struct map_ipos second = {-half_w + offset - 1, -half_h + 1};
+  struct map_ipos first_o;
+  struct map_ipos second_o;
+  map_to_offset_i(&first, &first_o);
+  map_to_offset_i(&second, &second_o);
+  struct hex_iter it;
+  hex_iter_rect(&it, &glob_layout, second_o.x, -half_h,
+      2 * half_w + first_o.x - second_o.x, 2 * half_h);
+  while (hex_iter_next(&it)) {
+    int map_x = it.pos.x - r_pos.x;
+    int map_y = it.pos.y - r_pos.y;
+    if (map_y >= 0 && map_y < glob_map->h) {
+      map_normalize_coordinates(glob_map, &map_x, &map_y);
+      int tile = mmap_get(glob_map, map_x, map_y);
+      draw_frame(x + center_x + it.screen.x, y + center_y + it.screen.y, tileset_get_frame_by_id(glob_tiles, tile));
+    }
+
+    if (map_x == mouse_map_x && map_y == mouse_map_y) {
+      // XXX dont draw mouse position for now
+      // draw_frame(x + center_x + it.screen.x, y + center_y + it.screen.y, tileset_get_frame_by_id(glob_tiles, 2));
     }
   }
 
   draw_color(255,255,255,255);
   draw_clip_null();
+  draw_progress(&glob_gen, x, y);
 }
 int glob_seed= 1234;
 static void draw(void *data)
@@ -0,0 +1,169 @@
+#include <stdatomic.h>
+#include "jobs.h"
+
+/* minimal fork/join helper: jobs_run() calls cb(data, job) for every job
+ * number on up to n_threads threads, the calling thread included, and
+ * returns once all jobs are done. jobs are handed out in order from a
+ * shared counter. without thread support everything runs inline. */
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define JOBS_NO_THREADS
+#endif
+
+#ifndef JOBS_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define JOBS_MAX_THREADS 64
+
+struct jobs_ctx {
+  job_cb cb;
+  void *data;
+  int n_jobs;
+  atomic_int next;
+  /* jobs_run_rounds() only */
+  jobs_round_cb round_cb;
+  int n_threads;
+  int arrived;
+  int round;
+  int done;
+#ifndef JOBS_NO_THREADS
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+};
+
+int jobs_cpu_count(void)
+{
+#ifndef JOBS_NO_THREADS
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > 0) {
+    return n < JOBS_MAX_THREADS ? n : JOBS_MAX_THREADS;
+  }
+#endif
+  return 1;
+}
+
+static void *jobs_worker(void *arg)
+{
+  struct jobs_ctx *ctx = arg;
+  int job;
+  while ((job = atomic_fetch_add(&ctx->next, 1)) < ctx->n_jobs) {
+    ctx->cb(ctx->data, job);
+  }
+  return NULL;
+}
+
+void jobs_run(int n_threads, int n_jobs, job_cb cb, void *data)
+{
+  struct jobs_ctx ctx;
+  ctx.cb = cb;
+  ctx.data = data;
+  ctx.n_jobs = n_jobs;
+  atomic_init(&ctx.next, 0);
+
+  if (n_threads > n_jobs) {
+    n_threads = n_jobs;
+  }
+  if (n_threads > JOBS_MAX_THREADS) {
+    n_threads = JOBS_MAX_THREADS;
+  }
+#ifndef JOBS_NO_THREADS
+  pthread_t threads[JOBS_MAX_THREADS];
+  int started = 0;
+  for (int i = 1; i < n_threads; ++i) {
+    if (pthread_create(&threads[started], NULL, jobs_worker, &ctx) == 0) {
+      ++started;
+    }
+  }
+  jobs_worker(&ctx);
+  for (int i = 0; i < started; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+#else
+  jobs_worker(&ctx);
+#endif
+}
+
+#ifndef JOBS_NO_THREADS
+/* runs the jobs of a round, then waits for the others. the last one to
+ * arrive calls round_cb and starts the next round or ends the loop. */
+static void *rounds_worker(void *arg)
+{
+  struct jobs_ctx *ctx = arg;
+  for (;;) {
+    jobs_worker(ctx);
+    pthread_mutex_lock(&ctx->lock);
+    int round = ctx->round;
+    if (++ctx->arrived == ctx->n_threads) {
+      ctx->arrived = 0;
+      if (ctx->round_cb(ctx->data)) {
+        atomic_store(&ctx->next, 0);
+      } else {
+        ctx->done = 1;
+      }
+      ++ctx->round;
+      pthread_cond_broadcast(&ctx->cond);
+    } else {
+      while (ctx->round == round) {
+        pthread_cond_wait(&ctx->cond, &ctx->lock);
+      }
+    }
+    int done = ctx->done;
+    pthread_mutex_unlock(&ctx->lock);
+    if (done) {
+      return NULL;
+    }
+  }
+}
+#endif
+
+void jobs_run_rounds(int n_threads, int n_jobs, job_cb cb,
+    jobs_round_cb round_cb, void *data)
+{
+  struct jobs_ctx ctx;
+  ctx.cb = cb;
+  ctx.data = data;
+  ctx.n_jobs = n_jobs;
+  ctx.round_cb = round_cb;
+  atomic_init(&ctx.next, 0);
+
+  if (n_threads > n_jobs) {
+    n_threads = n_jobs;
+  }
+  if (n_threads > JOBS_MAX_THREADS) {
+    n_threads = JOBS_MAX_THREADS;
+  }
+#ifndef JOBS_NO_THREADS
+  if (n_threads > 1) {
+    pthread_t threads[JOBS_MAX_THREADS];
+    int started = 0;
+    ctx.arrived = 0;
+    ctx.round = 0;
+    ctx.done = 0;
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+    /* the barrier needs to know how many threads really run */
+    pthread_mutex_lock(&ctx.lock);
+    for (int i = 1; i < n_threads; ++i) {
+      if (pthread_create(&threads[started], NULL, rounds_worker, &ctx) == 0) {
+        ++started;
+      }
+    }
+    ctx.n_threads = started + 1;
+    pthread_mutex_unlock(&ctx.lock);
+    rounds_worker(&ctx);
+    for (int i = 0; i < started; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+    return;
+  }
+#endif
+  do {
+    jobs_worker(&ctx);
+    atomic_store(&ctx.next, 0);
+  } while (round_cb(data));
+}
@@ -0,0 +1,15 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+typedef void (*job_cb)(void *data, int job);
+typedef int (*jobs_round_cb)(void *data);
+
+int jobs_cpu_count(void);
+void jobs_run(int n_threads, int n_jobs, job_cb cb, void *data);
+/* jobs_run() over and over: once all jobs of a round are done round_cb
+ * runs on one thread, with all others waiting, and another round starts
+ * if it returns nonzero. the threads are only started once. */
+void jobs_run_rounds(int n_threads, int n_jobs, job_cb cb,
+    jobs_round_cb round_cb, void *data);
+
+#endif
@@ -0,0 +1,404 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapfile.h"
+
+#define MAPFILE_MAGIC "HEXMAP\r\n"
+#define BYTE_ORDER_MARK 0x01020304u
+#define CHUNK_ALIGN 64
+#define LAYER_ALIGN 4096
+
+struct mapfile_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t chunk;
+  int32_t w;
+  int32_t h;
+  int32_t n_layers;
+  uint64_t chunk_table;
+  uint64_t layer_table;
+};
+
+struct mapfile_chunk {
+  uint64_t offset;
+  uint32_t capacity;
+  uint16_t n_palette;
+  uint8_t bits;
+  uint8_t unused;
+};
+
+struct mapfile_layer {
+  char name[MMAP_LAYER_NAME];
+  int32_t type;
+  uint32_t unused;
+  uint64_t offset;
+};
+
+/* an opened file, map->file */
+struct mapfile {
+  int fd;
+  int writable;
+  unsigned char *base;
+  uint64_t size;
+  int n_layers;
+  pthread_mutex_t lock;
+};
+
+static uint64_t align(uint64_t v, uint64_t a)
+{
+  return (v + a - 1) / a * a;
+}
+
+/* palette with room for 1 << bits entries and then the words */
+static uint64_t record_size(int bits)
+{
+  return ((1 << bits) + MMAP_BLOCK_WORDS(bits)) * sizeof(uint32_t);
+}
+
+static uint64_t layer_bytes(uint64_t n_chunks, int type)
+{
+  static const int sizes[] = {1, 2, 4, 4};
+  return n_chunks * MMAP_CHUNK_TILES * sizes[type];
+}
+
+static int write_at(FILE *f, uint64_t offset, const void *data, size_t n)
+{
+  return fseek(f, offset, SEEK_SET) == 0 && fwrite(data, 1, n, f) == n ? 0 : -1;
+}
+
+static void write_record(uint32_t *palette, struct mmap_block *block)
+{
+  int capacity = 1 << block->bits;
+  for (int p = 0; p < capacity; ++p) {
+    palette[p] = p < block->n_palette ? (uint32_t)block->palette[p] : 0;
+  }
+  memcpy(palette + capacity, block->words,
+      MMAP_BLOCK_WORDS(block->bits) * sizeof(uint32_t));
+}
+
+int mapfile_save(struct mmap *map, const char *path)
+{
+  int n = mmap_chunk_count(map);
+  struct mapfile_header header = {
+    MAPFILE_MAGIC, MAPFILE_VERSION, BYTE_ORDER_MARK, MMAP_CHUNK,
+    map->w, map->h, map->n_layers, 0, 0
+  };
+  header.chunk_table = sizeof(header);
+  header.layer_table = header.chunk_table + n * sizeof(struct mapfile_chunk);
+  struct mapfile_chunk *chunks = calloc(n, sizeof(*chunks));
+  struct mapfile_layer *layers = calloc(map->n_layers + 1, sizeof(*layers));
+  uint64_t end = header.layer_table + map->n_layers * sizeof(*layers);
+  for (int i = 0; i < n; ++i) {
+    struct mmap_block *block = mmap_block(map, i);
+    chunks[i].offset = align(end, CHUNK_ALIGN);
+    chunks[i].capacity = align(record_size(block->bits), CHUNK_ALIGN);
+    chunks[i].n_palette = block->n_palette;
+    chunks[i].bits = block->bits;
+    end = chunks[i].offset + chunks[i].capacity;
+  }
+  for (int i = 0; i < map->n_layers; ++i) {
+    memcpy(layers[i].name, map->layers[i].name, MMAP_LAYER_NAME);
+    layers[i].type = map->layers[i].type;
+    layers[i].offset = align(end, LAYER_ALIGN);
+    end = layers[i].offset + layer_bytes(n, layers[i].type);
+  }
+
+  int ret = -1;
+  uint32_t record[MMAP_CHUNK_TILES + MMAP_BLOCK_WORDS(8)];
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    goto out;
+  }
+  if (write_at(f, 0, &header, sizeof(header))
+      || write_at(f, header.chunk_table, chunks, n * sizeof(*chunks))
+      || write_at(f, header.layer_table, layers,
+          map->n_layers * sizeof(*layers))) {
+    goto out;
+  }
+  for (int i = 0; i < n; ++i) {
+    struct mmap_block *block = mmap_block(map, i);
+    write_record(record, block);
+    if (write_at(f, chunks[i].offset, record, record_size(block->bits))) {
+      goto out;
+    }
+  }
+  for (int i = 0; i < map->n_layers; ++i) {
+    if (write_at(f, layers[i].offset, map->layers[i].data,
+          layer_bytes(n, layers[i].type))) {
+      goto out;
+    }
+  }
+  ret = 0;
+out:
+  if (f && fclose(f)) {
+    ret = -1;
+  }
+  free(layers);
+  free(chunks);
+  return ret;
+}
+
+static struct mapfile_header *file_header(struct mapfile *file)
+{
+  return (struct mapfile_header *)file->base;
+}
+
+static struct mapfile_chunk *file_chunks(struct mapfile *file)
+{
+  return (struct mapfile_chunk *)(file->base + file_header(file)->chunk_table);
+}
+
+static struct mapfile_layer *file_layers(struct mapfile *file)
+{
+  return (struct mapfile_layer *)(file->base + file_header(file)->layer_table);
+}
+
+/* points a block at its chunk in the current mapping */
+static void borrow_block(struct mapfile *file, struct mmap_block *block,
+    int slot)
+{
+  struct mapfile_chunk *chunk = &file_chunks(file)[slot];
+  uint32_t *palette = (uint32_t *)(file->base + chunk->offset);
+  block->palette = (int *)palette;
+  block->words = palette + (1 << chunk->bits);
+  block->borrowed = 1;
+}
+
+static int bad_indices(struct mmap_block *block)
+{
+  unsigned int mask = (1u << block->bits) - 1;
+  for (int i = 0; i < MMAP_CHUNK_TILES; ++i) {
+    int bit = i * block->bits;
+    if ((block->words[bit >> 5] >> (bit & 31) & mask)
+        >= (unsigned int)block->n_palette) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* a damaged file may index past n_palette. such a chunk is copied and
+ * those tiles get entry 0 instead of reading past the palette. */
+static void clamp_indices(struct mmap_block *block)
+{
+  int n_words = MMAP_BLOCK_WORDS(block->bits);
+  unsigned int *words = malloc(n_words * sizeof(*words));
+  int *palette = calloc(1 << block->bits, sizeof(*palette));
+  memcpy(words, block->words, n_words * sizeof(*words));
+  memcpy(palette, block->palette, block->n_palette * sizeof(*palette));
+  block->words = words;
+  block->palette = palette;
+  block->borrowed = 0;
+  unsigned int mask = (1u << block->bits) - 1;
+  for (int i = 0; i < MMAP_CHUNK_TILES; ++i) {
+    int bit = i * block->bits;
+    unsigned int *word = &block->words[bit >> 5];
+    if ((*word >> (bit & 31) & mask) >= (unsigned int)block->n_palette) {
+      *word &= ~(mask << (bit & 31));
+    }
+  }
+}
+
+/* chunks are used in place, mmap.c copies them before they are set */
+static void load_block(struct mmap *map, int slot)
+{
+  struct mapfile *file = map->file;
+  struct mmap_block *block = &map->blocks[slot];
+  pthread_mutex_lock(&file->lock);
+  if (!atomic_load_explicit(&block->loaded, memory_order_relaxed)) {
+    struct mapfile_chunk *chunk = &file_chunks(file)[slot];
+    block->bits = chunk->bits;
+    block->n_palette = chunk->n_palette;
+    borrow_block(file, block, slot);
+    if (block->n_palette < 1 << block->bits && bad_indices(block)) {
+      clamp_indices(block);
+    }
+    block->dirty = 0;
+    atomic_store_explicit(&block->loaded, 1, memory_order_release);
+  }
+  pthread_mutex_unlock(&file->lock);
+}
+
+/* everything the tables point to is inside the file */
+static int file_valid(struct mapfile *file)
+{
+  struct mapfile_header *header = file_header(file);
+  if (file->size < sizeof(*header)
+      || memcmp(header->magic, MAPFILE_MAGIC, sizeof(header->magic))
+      || header->version != MAPFILE_VERSION
+      || header->byte_order != BYTE_ORDER_MARK
+      || header->chunk != MMAP_CHUNK
+      || header->w <= 0 || header->h <= 0 || header->n_layers < 0) {
+    return 0;
+  }
+  uint64_t n = (uint64_t)((header->w + MMAP_CHUNK - 1) / MMAP_CHUNK)
+      * ((header->h + MMAP_CHUNK - 1) / MMAP_CHUNK);
+  if (header->chunk_table + n * sizeof(struct mapfile_chunk) > file->size
+      || header->layer_table
+          + header->n_layers * sizeof(struct mapfile_layer) > file->size) {
+    return 0;
+  }
+  struct mapfile_chunk *chunks = file_chunks(file);
+  for (uint64_t i = 0; i < n; ++i) {
+    int bits = chunks[i].bits;
+    if ((bits != 1 && bits != 2 && bits != 4 && bits != 8)
+        || chunks[i].n_palette < 1 || chunks[i].n_palette > 1 << bits
+        || chunks[i].offset % CHUNK_ALIGN
+        || chunks[i].capacity < record_size(bits)
+        || chunks[i].offset + chunks[i].capacity > file->size) {
+      return 0;
+    }
+  }
+  struct mapfile_layer *layers = file_layers(file);
+  for (int i = 0; i < header->n_layers; ++i) {
+    if (layers[i].type < MMAP_LAYER_U8 || layers[i].type > MMAP_LAYER_F32
+        || layers[i].offset % LAYER_ALIGN
+        || layers[i].offset + layer_bytes(n, layers[i].type) > file->size) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* the first size bytes of the file, NULL on error */
+static unsigned char *map_file(struct mapfile *file, uint64_t size)
+{
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      file->writable ? MAP_SHARED : MAP_PRIVATE, file->fd, 0);
+  return base == MAP_FAILED ? NULL : base;
+}
+
+/* points the layers of the file and the borrowed chunks into the
+ * current mapping */
+static void attach_layers(struct mmap *map, struct mapfile *file)
+{
+  struct mapfile_layer *layers = file_layers(file);
+  for (int i = 0; i < file->n_layers; ++i) {
+    map->layers[i].data = file->base + layers[i].offset;
+  }
+  for (int i = 0; i < mmap_chunk_count(map); ++i) {
+    struct mmap_block *block = &map->blocks[i];
+    if (atomic_load(&block->loaded) && block->borrowed) {
+      borrow_block(file, block, i);
+    }
+  }
+}
+
+int mapfile_open(struct mmap *map, const char *path, int writable)
+{
+  struct stat st;
+  struct mapfile *file = calloc(1, sizeof(*file));
+  file->writable = writable;
+  file->fd = open(path, writable ? O_RDWR : O_RDONLY);
+  if (file->fd < 0) {
+    free(file);
+    return -1;
+  }
+  if (fstat(file->fd, &st) || st.st_size <= 0) {
+    goto fail;
+  }
+  file->size = st.st_size;
+  file->base = map_file(file, file->size);
+  if (!file->base) {
+    goto fail;
+  }
+  if (!file_valid(file)) {
+    munmap(file->base, file->size);
+    goto fail;
+  }
+  struct mapfile_header *header = file_header(file);
+  struct mapfile_layer *layers = file_layers(file);
+  pthread_mutex_init(&file->lock, NULL);
+  mmap_init_lazy(map, header->w, header->h, load_block, file);
+  for (int i = 0; i < header->n_layers; ++i) {
+    char name[MMAP_LAYER_NAME];
+    memcpy(name, layers[i].name, MMAP_LAYER_NAME);
+    name[MMAP_LAYER_NAME - 1] = 0;
+    /* attach_layers() relies on layer i of the file being layer i of
+     * the map, a repeated name would break that */
+    if (mmap_layer_attach(map, name, layers[i].type,
+          file->base + layers[i].offset) != i) {
+      mmap_free(map);
+      pthread_mutex_destroy(&file->lock);
+      munmap(file->base, file->size);
+      goto fail;
+    }
+  }
+  file->n_layers = header->n_layers;
+  return 0;
+fail:
+  close(file->fd);
+  free(file);
+  return -1;
+}
+
+/* grows the file to size bytes and maps it again */
+static int grow(struct mmap *map, struct mapfile *file, uint64_t size)
+{
+  if (ftruncate(file->fd, size)) {
+    return -1;
+  }
+  /* the old mapping stays valid, and in use, until the new one exists */
+  unsigned char *base = map_file(file, size);
+  if (!base) {
+    return -1;
+  }
+  munmap(file->base, file->size);
+  file->base = base;
+  file->size = size;
+  attach_layers(map, file);
+  return 0;
+}
+
+int mapfile_flush(struct mmap *map)
+{
+  struct mapfile *file = map->file;
+  if (!file || !file->writable) {
+    return -1;
+  }
+  for (int i = 0; i < mmap_chunk_count(map); ++i) {
+    struct mmap_block *block = &map->blocks[i];
+    if (!atomic_load(&block->loaded) || !block->dirty) {
+      continue;
+    }
+    uint64_t size = record_size(block->bits);
+    if (size > file_chunks(file)[i].capacity) {
+      uint64_t offset = align(file->size, CHUNK_ALIGN);
+      if (grow(map, file, offset + align(size, CHUNK_ALIGN))) {
+        return -1;
+      }
+      file_chunks(file)[i].offset = offset;
+      file_chunks(file)[i].capacity = align(size, CHUNK_ALIGN);
+    }
+    struct mapfile_chunk *chunk = &file_chunks(file)[i];
+    write_record((uint32_t *)(file->base + chunk->offset), block);
+    chunk->bits = block->bits;
+    chunk->n_palette = block->n_palette;
+    /* the file has the chunk now, the copy is not needed any more */
+    free(block->words);
+    free(block->palette);
+    borrow_block(file, block, i);
+    block->dirty = 0;
+  }
+  return msync(file->base, file->size, MS_SYNC) ? -1 : 0;
+}
+
+void mapfile_close(struct mmap *map)
+{
+  struct mapfile *file = map->file;
+  mmap_free(map);
+  if (file) {
+    munmap(file->base, file->size);
+    close(file->fd);
+    pthread_mutex_destroy(&file->lock);
+    free(file);
+  }
+  map->file = NULL;
+  map->load_block = NULL;
+}
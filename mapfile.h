@@ -0,0 +1,48 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include "mmap.h"
+
+#define MAPFILE_VERSION 1
+
+/* maps on disk. the file is a header, a table of the chunks and one of
+ * the layers, the palettized chunks and the layers, everything in the
+ * storage order of struct mmap:
+ *
+ *   header       magic, version, byte order, chunk size, w, h, tables
+ *   chunk table  offset, capacity, bits and palette size of every chunk
+ *   layer table  name, type and offset of every layer
+ *   chunks       1 << bits palette entries and the packed words, each
+ *                chunk on its own 64 byte boundary
+ *   layers       the raw layer arrays, each on a page boundary
+ *
+ * numbers are in the byte order of the machine that wrote the file, files
+ * from the other byte order are refused.
+ *
+ * mapfile_open() maps the file into memory, so opening is instant
+ * whatever the map size and only the pages that are touched are read.
+ * chunks and layers are used straight from the mapping and can be paged
+ * out again like any file data, so maps bigger than memory work as long
+ * as they are mostly read. a chunk is copied to the heap the first time
+ * it is set and stays there until mapfile_flush() writes it back. maps
+ * opened read only can not be flushed, each chunk that is set stays on
+ * the heap until mapfile_close(). */
+
+/* writes the whole map, not to the file the map is opened from, use
+ * mapfile_flush() for that one. 0 on success, -1 on error. */
+int mapfile_save(struct mmap *map, const char *path);
+/* opens a file written by mapfile_save() as map. writable maps write
+ * layer changes through to the file and mapfile_flush() writes the
+ * chunks back, otherwise changes stay in memory. 0 on success, -1 if the
+ * file can not be opened or is no map file of this version. */
+int mapfile_open(struct mmap *map, const char *path, int writable);
+/* writes changed chunks back and syncs the file. chunks that outgrew
+ * their place in the file move to its end. layers added after opening
+ * are not written, mapfile_save() does that. not to be called while
+ * other threads use the map. 0 on success, -1 on error. */
+int mapfile_flush(struct mmap *map);
+/* unmaps the file and frees the map. chunk changes that were not
+ * flushed are lost, layer changes of writable maps are in the file. */
+void mapfile_close(struct mmap *map);
+
+#endif
@@ -0,0 +1,139 @@
+#include "mapfile.h"
+#include "mapgen.h"
+
+static void free_map(struct mmap *map)
+{
+  if (map->w) {
+    mapfile_close(map);
+    map->w = 0;
+  }
+}
+
+/* makes the map of seed in the back buffer, called without the lock */
+static void make_back(struct mapgen *gen, struct mmap *back, int seed)
+{
+  free_map(back);
+  if (gen->cb(back, seed, &gen->status, gen->data)) {
+    back->w = 0;
+  }
+}
+
+#ifndef MAPGEN_NO_THREADS
+static void *worker(void *arg)
+{
+  struct mapgen *gen = arg;
+  pthread_mutex_lock(&gen->lock);
+  for (;;) {
+    while (!gen->pending && !gen->quit) {
+      pthread_cond_wait(&gen->cond, &gen->lock);
+    }
+    if (gen->quit) {
+      break;
+    }
+    int seed = gen->seed;
+    gen->pending = 0;
+    /* a finished map that was not swapped in yet is out of date now,
+     * without ready the drawing thread leaves the back map alone */
+    atomic_store(&gen->ready, 0);
+    atomic_store(&gen->status.cancel, 0);
+    atomic_store(&gen->status.total, 0);
+    struct mmap *back = &gen->maps[!gen->front];
+    pthread_mutex_unlock(&gen->lock);
+    make_back(gen, back, seed);
+    pthread_mutex_lock(&gen->lock);
+    if (gen->pending) {
+      free_map(back);
+    } else if (back->w) {
+      atomic_store_explicit(&gen->ready, 1, memory_order_release);
+    }
+  }
+  pthread_mutex_unlock(&gen->lock);
+  return NULL;
+}
+#endif
+
+void mapgen_init(struct mapgen *gen, mapgen_cb cb, void *data)
+{
+  gen->cb = cb;
+  gen->data = data;
+  gen->maps[0].w = 0;
+  gen->maps[1].w = 0;
+  gen->front = 0;
+  gen->has_front = 0;
+  atomic_init(&gen->ready, 0);
+  atomic_init(&gen->status.done, 0);
+  atomic_init(&gen->status.total, 0);
+  atomic_init(&gen->status.cancel, 0);
+  gen->seed = 0;
+  gen->pending = 0;
+  gen->quit = 0;
+  gen->threaded = 0;
+#ifndef MAPGEN_NO_THREADS
+  pthread_mutex_init(&gen->lock, NULL);
+  pthread_cond_init(&gen->cond, NULL);
+  gen->threaded = pthread_create(&gen->thread, NULL, worker, gen) == 0;
+#endif
+}
+
+void mapgen_free(struct mapgen *gen)
+{
+#ifndef MAPGEN_NO_THREADS
+  if (gen->threaded) {
+    pthread_mutex_lock(&gen->lock);
+    gen->quit = 1;
+    atomic_store(&gen->status.cancel, 1);
+    pthread_cond_signal(&gen->cond);
+    pthread_mutex_unlock(&gen->lock);
+    pthread_join(gen->thread, NULL);
+  }
+  pthread_cond_destroy(&gen->cond);
+  pthread_mutex_destroy(&gen->lock);
+#endif
+  free_map(&gen->maps[0]);
+  free_map(&gen->maps[1]);
+}
+
+void mapgen_request(struct mapgen *gen, int seed)
+{
+#ifndef MAPGEN_NO_THREADS
+  if (gen->threaded) {
+    pthread_mutex_lock(&gen->lock);
+    gen->seed = seed;
+    gen->pending = 1;
+    atomic_store(&gen->status.cancel, 1);
+    pthread_cond_signal(&gen->cond);
+    pthread_mutex_unlock(&gen->lock);
+    return;
+  }
+#endif
+  struct mmap *back = &gen->maps[!gen->front];
+  make_back(gen, back, seed);
+  atomic_store(&gen->ready, back->w != 0);
+}
+
+struct mmap *mapgen_swap(struct mapgen *gen)
+{
+  if (atomic_load_explicit(&gen->ready, memory_order_acquire)) {
+#ifndef MAPGEN_NO_THREADS
+    pthread_mutex_lock(&gen->lock);
+#endif
+    /* the worker may have dropped it for a newer request meanwhile */
+    if (atomic_load(&gen->ready)) {
+      gen->front = !gen->front;
+      gen->has_front = 1;
+      atomic_store(&gen->ready, 0);
+    }
+#ifndef MAPGEN_NO_THREADS
+    pthread_mutex_unlock(&gen->lock);
+#endif
+  }
+  return gen->has_front ? &gen->maps[gen->front] : NULL;
+}
+
+float mapgen_progress(struct mapgen *gen)
+{
+  if (atomic_load(&gen->ready) || !atomic_load(&gen->status.total)) {
+    return 1;
+  }
+  return worldgen_progress(&gen->status);
+}
@@ -0,0 +1,60 @@
+#ifndef MAPGEN_H
+#define MAPGEN_H
+
+#include "mmap.h"
+#include "worldgen.h"
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define MAPGEN_NO_THREADS
+#endif
+
+#ifndef MAPGEN_NO_THREADS
+#include <pthread.h>
+#endif
+
+/* makes the map of seed, on the worker thread. returns 0 with map filled
+ * in, or -1 with nothing to free, e.g. when status got cancelled. */
+typedef int (*mapgen_cb)(struct mmap *map, int seed,
+    struct worldgen_status *status, void *data);
+
+/* maps made in the background, double buffered: the front map is the one
+ * that is drawn, the worker fills the other one. mapgen_swap() at a frame
+ * boundary makes a finished map the front, nothing waits for the worker
+ * in between. a new request cancels the one that is running.
+ *
+ * maps are freed with mapfile_close(), which works for maps in memory
+ * too. without thread support requests run inline. */
+struct mapgen {
+  mapgen_cb cb;
+  void *data;
+  struct mmap maps[2];
+  /* index of the front map, has_front once there is one */
+  int front;
+  int has_front;
+  /* the back map is finished and waits for mapgen_swap() */
+  atomic_int ready;
+  struct worldgen_status status;
+  /* newest request, pending until the worker picks it up */
+  int seed;
+  int pending;
+  int quit;
+  /* 0 if the worker could not be started, requests run inline then */
+  int threaded;
+#ifndef MAPGEN_NO_THREADS
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+};
+
+void mapgen_init(struct mapgen *gen, mapgen_cb cb, void *data);
+/* stops the worker and frees both maps */
+void mapgen_free(struct mapgen *gen);
+void mapgen_request(struct mapgen *gen, int seed);
+/* call from the thread that draws, between frames. returns the front map
+ * or NULL if no map is finished yet. */
+struct mmap *mapgen_swap(struct mapgen *gen);
+/* 0 .. 1 for the map in the making, 1 if there is none */
+float mapgen_progress(struct mapgen *gen);
+
+#endif
@@ -0,0 +1,450 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mmap.h"
+
+#define CHUNK_MASK (MMAP_CHUNK - 1)
+
+/* palette index of tile i */
+static int block_index(struct mmap_block *block, int i)
+{
+  int bit = i * block->bits;
+  return (block->words[bit >> 5] >> (bit & 31)) & ((1u << block->bits) - 1);
+}
+
+static void block_put(struct mmap_block *block, int i, int index)
+{
+  int bit = i * block->bits;
+  unsigned int mask = ((1u << block->bits) - 1) << (bit & 31);
+  unsigned int *word = &block->words[bit >> 5];
+  *word = (*word & ~mask) | ((unsigned int)index << (bit & 31));
+}
+
+static void block_init(struct mmap_block *block, int v)
+{
+  block->bits = 1;
+  block->words = calloc(MMAP_BLOCK_WORDS(1), sizeof(*block->words));
+  block->palette = malloc(2 * sizeof(*block->palette));
+  block->palette[0] = v;
+  block->n_palette = 1;
+  block->dirty = 0;
+  block->borrowed = 0;
+  atomic_init(&block->loaded, 1);
+}
+
+/* copies the words and palette of a borrowed block before it changes */
+static void block_own(struct mmap_block *block)
+{
+  if (!block->borrowed) {
+    return;
+  }
+  int n_words = MMAP_BLOCK_WORDS(block->bits);
+  unsigned int *words = malloc(n_words * sizeof(*words));
+  int *palette = malloc((1 << block->bits) * sizeof(*palette));
+  memcpy(words, block->words, n_words * sizeof(*words));
+  memcpy(palette, block->palette, block->n_palette * sizeof(*palette));
+  block->words = words;
+  block->palette = palette;
+  block->borrowed = 0;
+}
+
+/* moves the tiles to bits per tile with the palette index of tile i
+ * mapped through remap, or kept if remap is NULL */
+static void block_repack(struct mmap_block *block, int bits, const int *remap)
+{
+  struct mmap_block packed = {
+    .words = calloc(MMAP_BLOCK_WORDS(bits), sizeof(*packed.words)),
+    .bits = bits
+  };
+  for (int i = 0; i < MMAP_CHUNK_TILES; ++i) {
+    int index = block_index(block, i);
+    block_put(&packed, i, remap ? remap[index] : index);
+  }
+  free(block->words);
+  block->words = packed.words;
+  block->bits = bits;
+  block->palette = realloc(block->palette, (1 << bits) * sizeof(*block->palette));
+}
+
+/* drops the palette entries no tile uses, tile skip does not count and
+ * ends up with index 0. the remaining entries keep their order. */
+static void block_compact(struct mmap_block *block, int skip)
+{
+  int remap[MMAP_CHUNK_TILES];
+  int used[MMAP_CHUNK_TILES] = {0};
+  for (int i = 0; i < MMAP_CHUNK_TILES; ++i) {
+    if (i != skip) {
+      used[block_index(block, i)] = 1;
+    }
+  }
+  int n = 0;
+  for (int p = 0; p < block->n_palette; ++p) {
+    remap[p] = used[p] ? n : 0;
+    if (used[p]) {
+      block->palette[n++] = block->palette[p];
+    }
+  }
+  if (!n) {
+    n = 1;
+  }
+  int bits = 1;
+  while ((1 << bits) < n) {
+    bits *= 2;
+  }
+  block->n_palette = n;
+  block_repack(block, bits, remap);
+}
+
+/* palette index of v, added if it is not there yet. tile i is about to
+ * be overwritten with it. */
+static int block_palette_index(struct mmap_block *block, int v, int i)
+{
+  for (int p = 0; p < block->n_palette; ++p) {
+    if (block->palette[p] == v) {
+      return p;
+    }
+  }
+  /* with 8 bits the palette is only full of stale values, tile i
+   * included, as a chunk has no more tiles than that */
+  if (block->n_palette == 1 << block->bits && block->bits == 8) {
+    block_compact(block, i);
+  }
+  if (block->n_palette == 1 << block->bits) {
+    block_repack(block, block->bits * 2, NULL);
+  }
+  block->palette[block->n_palette] = v;
+  return block->n_palette++;
+}
+
+/* every other bit of v, the x (or y) half of a morton code */
+static int morton_bits(unsigned int code)
+{
+  int v = 0;
+  for (int bit = 0; code >> (2 * bit); ++bit) {
+    v |= ((code >> (2 * bit)) & 1) << bit;
+  }
+  return v;
+}
+
+/* numbers the chunks in z order. with chunks_x != chunks_y or sizes that
+ * are no power of two the codes outside the map are skipped. */
+static void init_chunk_order(struct mmap *map)
+{
+  int n = map->chunks_x * map->chunks_y;
+  unsigned int side = 1;
+  while (side < (unsigned int)map->chunks_x || side < (unsigned int)map->chunks_y) {
+    side *= 2;
+  }
+  map->chunk_index = malloc(2 * n * sizeof(*map->chunk_index));
+  map->chunk_order = map->chunk_index + n;
+  int slot = 0;
+  for (unsigned int code = 0; code < side * side; ++code) {
+    int cx = morton_bits(code);
+    int cy = morton_bits(code >> 1);
+    if (cx < map->chunks_x && cy < map->chunks_y) {
+      map->chunk_index[cy * map->chunks_x + cx] = slot;
+      map->chunk_order[slot] = cy * map->chunks_x + cx;
+      ++slot;
+    }
+  }
+}
+
+void mmap_init(struct mmap *map, int w, int h, int v)
+{
+  map->w = w;
+  map->h = h;
+  map->chunks_x = (w + CHUNK_MASK) >> MMAP_CHUNK_SHIFT;
+  map->chunks_y = (h + CHUNK_MASK) >> MMAP_CHUNK_SHIFT;
+  int n = map->chunks_x * map->chunks_y;
+  map->blocks = malloc(n * sizeof(*map->blocks));
+  for (int i = 0; i < n; ++i) {
+    block_init(&map->blocks[i], v);
+  }
+  init_chunk_order(map);
+  map->layers = NULL;
+  map->n_layers = 0;
+  map->load_block = NULL;
+  map->file = NULL;
+}
+
+void mmap_init_lazy(struct mmap *map, int w, int h, mmap_load_cb load_block,
+    void *file)
+{
+  map->w = w;
+  map->h = h;
+  map->chunks_x = (w + CHUNK_MASK) >> MMAP_CHUNK_SHIFT;
+  map->chunks_y = (h + CHUNK_MASK) >> MMAP_CHUNK_SHIFT;
+  int n = map->chunks_x * map->chunks_y;
+  map->blocks = calloc(n, sizeof(*map->blocks));
+  for (int i = 0; i < n; ++i) {
+    atomic_init(&map->blocks[i].loaded, 0);
+  }
+  init_chunk_order(map);
+  map->layers = NULL;
+  map->n_layers = 0;
+  map->load_block = load_block;
+  map->file = file;
+}
+
+void mmap_free(struct mmap *map)
+{
+  for (int i = 0; i < mmap_chunk_count(map); ++i) {
+    if (!map->blocks[i].borrowed) {
+      free(map->blocks[i].words);
+      free(map->blocks[i].palette);
+    }
+  }
+  for (int i = 0; i < map->n_layers; ++i) {
+    if (!map->layers[i].attached) {
+      free(map->layers[i].data);
+    }
+  }
+  free(map->layers);
+  free(map->blocks);
+  free(map->chunk_index);
+  map->layers = NULL;
+  map->n_layers = 0;
+  map->blocks = NULL;
+  map->chunk_index = NULL;
+  map->chunk_order = NULL;
+}
+
+/* v mod m in 0 .. m - 1 for negative v too */
+static int wrap(int v, int m)
+{
+  v %= m;
+  return v < 0 ? v + m : v;
+}
+
+/* storage slot of the chunk of tile (x, y), x and y inside the map */
+static int chunk_slot(struct mmap *map, int x, int y)
+{
+  return map->chunk_index[(y >> MMAP_CHUNK_SHIFT) * map->chunks_x
+      + (x >> MMAP_CHUNK_SHIFT)];
+}
+
+struct mmap_block *mmap_block(struct mmap *map, int slot)
+{
+  struct mmap_block *block = &map->blocks[slot];
+  if (map->load_block
+      && !atomic_load_explicit(&block->loaded, memory_order_acquire)) {
+    map->load_block(map, slot);
+  }
+  return block;
+}
+
+static struct mmap_block *block_at(struct mmap *map, int x, int y)
+{
+  return mmap_block(map, chunk_slot(map, x, y));
+}
+
+static int tile_in_block(int x, int y)
+{
+  return ((y & CHUNK_MASK) << MMAP_CHUNK_SHIFT) + (x & CHUNK_MASK);
+}
+
+void mmap_set(struct mmap* map, int x, int y, int v)
+{
+  if (y < 0) {
+    y = wrap(y, map->h);
+  }
+  x = wrap(x - y / 2, map->w);
+  y %= map->h;
+  struct mmap_block *block = block_at(map, x, y);
+  int i = tile_in_block(x, y);
+  block_own(block);
+  block_put(block, i, block_palette_index(block, v, i));
+  block->dirty = 1;
+}
+
+int mmap_get(struct mmap* map, int x, int y)
+{
+  x %= map->w;
+  struct mmap_block *block = block_at(map, x, y);
+  return block->palette[block_index(block, tile_in_block(x, y))];
+}
+
+void mmap_get_row(struct mmap *map, int x0, int y, int w, int *out)
+{
+  int x = wrap(x0, map->w);
+  while (w > 0) {
+    /* up to the end of the chunk or of the map, whichever comes first */
+    int n = MMAP_CHUNK - (x & CHUNK_MASK);
+    if (n > map->w - x) {
+      n = map->w - x;
+    }
+    if (n > w) {
+      n = w;
+    }
+    struct mmap_block *block = block_at(map, x, y);
+    int bits = block->bits;
+    unsigned int mask = (1u << bits) - 1;
+    int bit = tile_in_block(x, y) * bits;
+    for (int i = 0; i < n; ++i, bit += bits) {
+      *out++ = block->palette[(block->words[bit >> 5] >> (bit & 31)) & mask];
+    }
+    w -= n;
+    x += n;
+    if (x == map->w) {
+      x = 0;
+    }
+  }
+}
+
+void map_normalize_coordinates(struct mmap* map, int *x_par, int *y_par)
+{
+  int y = wrap(*y_par, map->h);
+  /* every time y wraps around the map x moves by half the map height */
+  int k = (*y_par - y) / map->h;
+  *x_par = wrap(*x_par + k * (map->h / 2), map->w);
+  *y_par = y;
+}
+
+void mmap_compact(struct mmap *map)
+{
+  for (int i = 0; i < mmap_chunk_count(map); ++i) {
+    struct mmap_block *block = mmap_block(map, i);
+    block_own(block);
+    block_compact(block, -1);
+    block->dirty = 1;
+  }
+}
+
+long mmap_memory(struct mmap *map)
+{
+  int n = mmap_chunk_count(map);
+  long bytes = n * (sizeof(*map->blocks) + 2 * sizeof(*map->chunk_index));
+  for (int i = 0; i < n; ++i) {
+    int bits = map->blocks[i].bits;
+    if (map->blocks[i].words && !map->blocks[i].borrowed) {
+      bytes += MMAP_BLOCK_WORDS(bits) * sizeof(*map->blocks[i].words)
+          + (1 << bits) * sizeof(*map->blocks[i].palette);
+    }
+  }
+  return bytes;
+}
+
+int mmap_chunk_count(struct mmap *map)
+{
+  return map->chunks_x * map->chunks_y;
+}
+
+void mmap_chunk(struct mmap *map, int i, struct mmap_chunk *chunk)
+{
+  int cx = map->chunk_order[i] % map->chunks_x;
+  int cy = map->chunk_order[i] / map->chunks_x;
+  chunk->x0 = cx << MMAP_CHUNK_SHIFT;
+  chunk->y0 = cy << MMAP_CHUNK_SHIFT;
+  chunk->w = map->w - chunk->x0 < MMAP_CHUNK ? map->w - chunk->x0 : MMAP_CHUNK;
+  chunk->h = map->h - chunk->y0 < MMAP_CHUNK ? map->h - chunk->y0 : MMAP_CHUNK;
+  chunk->slot = i;
+}
+
+void mmap_chunk_at(struct mmap *map, int x, int y, struct mmap_chunk *chunk)
+{
+  mmap_chunk(map, chunk_slot(map, x, y), chunk);
+}
+
+void mmap_chunk_unpack(struct mmap *map, struct mmap_chunk *chunk, int *out)
+{
+  struct mmap_block *block = mmap_block(map, chunk->slot);
+  for (int i = 0; i < MMAP_CHUNK_TILES; ++i) {
+    out[i] = block->palette[block_index(block, i)];
+  }
+}
+
+static const int layer_sizes[] = {
+  sizeof(uint8_t), sizeof(uint16_t), sizeof(int32_t), sizeof(float)
+};
+
+int mmap_layer_find(struct mmap *map, const char *name)
+{
+  for (int i = 0; i < map->n_layers; ++i) {
+    if (!strncmp(map->layers[i].name, name, MMAP_LAYER_NAME - 1)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int layer_add(struct mmap *map, const char *name,
+    enum mmap_layer_type type, void *data)
+{
+  int id = mmap_layer_find(map, name);
+  if (id >= 0) {
+    return map->layers[id].type == type && !data ? id : -1;
+  }
+  map->layers = realloc(map->layers, (map->n_layers + 1) * sizeof(*map->layers));
+  struct mmap_layer *layer = &map->layers[map->n_layers];
+  strncpy(layer->name, name, MMAP_LAYER_NAME - 1);
+  layer->name[MMAP_LAYER_NAME - 1] = 0;
+  layer->type = type;
+  layer->size = layer_sizes[type];
+  layer->attached = data != NULL;
+  layer->data = data ? data
+      : calloc(mmap_chunk_count(map) * MMAP_CHUNK_TILES, layer->size);
+  return map->n_layers++;
+}
+
+int mmap_layer_add(struct mmap *map, const char *name, enum mmap_layer_type type)
+{
+  return layer_add(map, name, type, NULL);
+}
+
+int mmap_layer_attach(struct mmap *map, const char *name,
+    enum mmap_layer_type type, void *data)
+{
+  return layer_add(map, name, type, data);
+}
+
+void *mmap_layer_chunk(struct mmap *map, int layer, struct mmap_chunk *chunk)
+{
+  struct mmap_layer *l = &map->layers[layer];
+  return (char *)l->data + chunk->slot * MMAP_CHUNK_TILES * l->size;
+}
+
+/* element index of tile (x, y) in every layer */
+static int layer_index(struct mmap *map, int x, int y)
+{
+  x %= map->w;
+  return chunk_slot(map, x, y) * MMAP_CHUNK_TILES + tile_in_block(x, y);
+}
+
+uint8_t mmap_get_u8(struct mmap *map, int layer, int x, int y)
+{
+  return ((uint8_t *)map->layers[layer].data)[layer_index(map, x, y)];
+}
+
+void mmap_set_u8(struct mmap *map, int layer, int x, int y, uint8_t v)
+{
+  ((uint8_t *)map->layers[layer].data)[layer_index(map, x, y)] = v;
+}
+
+uint16_t mmap_get_u16(struct mmap *map, int layer, int x, int y)
+{
+  return ((uint16_t *)map->layers[layer].data)[layer_index(map, x, y)];
+}
+
+void mmap_set_u16(struct mmap *map, int layer, int x, int y, uint16_t v)
+{
+  ((uint16_t *)map->layers[layer].data)[layer_index(map, x, y)] = v;
+}
+
+int32_t mmap_get_i32(struct mmap *map, int layer, int x, int y)
+{
+  return ((int32_t *)map->layers[layer].data)[layer_index(map, x, y)];
+}
+
+void mmap_set_i32(struct mmap *map, int layer, int x, int y, int32_t v)
+{
+  ((int32_t *)map->layers[layer].data)[layer_index(map, x, y)] = v;
+}
+
+float mmap_get_f32(struct mmap *map, int layer, int x, int y)
+{
+  return ((float *)map->layers[layer].data)[layer_index(map, x, y)];
+}
+
+void mmap_set_f32(struct mmap *map, int layer, int x, int y, float v)
+{
+  ((float *)map->layers[layer].data)[layer_index(map, x, y)] = v;
+}
@@ -0,0 +1,161 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* chunks are MMAP_CHUNK * MMAP_CHUNK tiles */
+#define MMAP_CHUNK_SHIFT 4
+#define MMAP_CHUNK (1 << MMAP_CHUNK_SHIFT)
+#define MMAP_CHUNK_TILES (MMAP_CHUNK * MMAP_CHUNK)
+/* words of a chunk packed with bits per tile */
+#define MMAP_BLOCK_WORDS(bits) (MMAP_CHUNK_TILES * (bits) / 32)
+
+/* the tiles of one chunk: indices into palette, bits (1, 2, 4 or 8) each,
+ * packed into words row-major. a chunk never has more than
+ * MMAP_CHUNK_TILES distinct values, so 8 bits are always enough. the
+ * palette has room for 1 << bits values.
+ *
+ * maps loaded from a file start with no chunk loaded, dirty marks chunks
+ * set since they were loaded or written back. words and palette of
+ * borrowed chunks belong to someone else, e.g. a file mapping, they are
+ * copied before the chunk changes and never freed. */
+struct mmap_block {
+  unsigned int *words;
+  int *palette;
+  int n_palette;
+  int bits;
+  int dirty;
+  int borrowed;
+  atomic_int loaded;
+};
+
+enum mmap_layer_type {
+  MMAP_LAYER_U8,
+  MMAP_LAYER_U16,
+  MMAP_LAYER_I32,
+  MMAP_LAYER_F32
+};
+
+#define MMAP_LAYER_NAME 24
+
+/* one attribute of every tile, dense and in the chunk layout of the map:
+ * the tiles of storage slot s start at element s * MMAP_CHUNK_TILES.
+ * data of attached layers belongs to someone else, see
+ * mmap_layer_attach(). */
+struct mmap_layer {
+  char name[MMAP_LAYER_NAME];
+  enum mmap_layer_type type;
+  int size;
+  void *data;
+  int attached;
+};
+
+struct mmap;
+typedef void (*mmap_load_cb)(struct mmap *map, int slot);
+
+/* tile map in map (axial) coordinates. it wraps horizontally, and
+ * wrapping vertically shifts x by half the map height, see
+ * map_normalize_coordinates().
+ *
+ * tiles are stored in chunks of MMAP_CHUNK * MMAP_CHUNK, row-major inside
+ * a chunk and the chunks in Morton (z) order, so tiles close on the map
+ * are close in memory in both directions. chunk_index has the storage
+ * slot of every chunk, row-major over chunks_x * chunks_y, chunk_order
+ * the chunk in every slot. chunks on the right and bottom edge are
+ * padded if w or h is not a multiple of MMAP_CHUNK.
+ *
+ * every chunk is palettized with as few bits per tile as its values need,
+ * a map of three tile types takes 2 bits per tile instead of 32. a
+ * palette only grows when tiles are set, mmap_compact() drops values that
+ * are gone. setting tiles of different chunks from different threads is
+ * fine, of the same chunk it is not.
+ *
+ * other attributes (elevation, owner, movement cost, ...) live in layers,
+ * one array per attribute, so a pass only streams the bytes it reads.
+ * the palettized tiles are the terrain.
+ *
+ * with load_block set chunks are loaded the first time they are used,
+ * file is for load_block, see mapfile.h. */
+struct mmap {
+  int w;
+  int h;
+  struct mmap_block *blocks;
+  int chunks_x;
+  int chunks_y;
+  int *chunk_index;
+  int *chunk_order;
+  struct mmap_layer *layers;
+  int n_layers;
+  mmap_load_cb load_block;
+  void *file;
+};
+
+/* one chunk: tiles x0 .. x0 + w - 1, y0 .. y0 + h - 1 of the map in
+ * storage slot slot */
+struct mmap_chunk {
+  int x0;
+  int y0;
+  int w;
+  int h;
+  int slot;
+};
+
+void mmap_init(struct mmap *map, int w, int h, int v);
+/* a map of w * h with no chunk loaded. load_block has to fill in words,
+ * palette, n_palette, bits and borrowed of the block of slot and set
+ * loaded, it may be called from several threads at once. */
+void mmap_init_lazy(struct mmap *map, int w, int h, mmap_load_cb load_block,
+    void *file);
+void mmap_free(struct mmap *map);
+void mmap_set(struct mmap* map, int x, int y, int v);
+int mmap_get(struct mmap* map, int x, int y);
+void map_normalize_coordinates(struct mmap* map, int *x_par, int *y_par);
+
+/* tiles x0 .. x0 + w - 1 of row y (map coordinates, x wraps) to out */
+void mmap_get_row(struct mmap *map, int x0, int y, int w, int *out);
+
+/* rebuilds every palette from the tiles it is used by and packs the
+ * chunk with as few bits as that allows */
+void mmap_compact(struct mmap *map);
+/* bytes of the terrain tiles, palettes included, layers not. chunks that
+ * are not loaded or borrowed do not count. */
+long mmap_memory(struct mmap *map);
+/* the block of slot, loaded if it was not */
+struct mmap_block *mmap_block(struct mmap *map, int slot);
+
+/* chunks in storage order, i from 0 to mmap_chunk_count() - 1. walking
+ * them in this order touches the tiles in the order they are stored. */
+int mmap_chunk_count(struct mmap *map);
+void mmap_chunk(struct mmap *map, int i, struct mmap_chunk *chunk);
+/* the chunk holding tile (x, y), x and y inside the map */
+void mmap_chunk_at(struct mmap *map, int x, int y, struct mmap_chunk *chunk);
+/* all MMAP_CHUNK_TILES tiles of the chunk to out, tile (x, y) is
+ * out[(y - y0) * MMAP_CHUNK + x - x0], padding included */
+void mmap_chunk_unpack(struct mmap *map, struct mmap_chunk *chunk, int *out);
+
+/* adds a layer of zeros and returns its id. if a layer of that name
+ * exists already its id is returned, or -1 if its type differs. */
+int mmap_layer_add(struct mmap *map, const char *name, enum mmap_layer_type type);
+/* like mmap_layer_add() but with data owned by the caller, e.g. a file
+ * mapping. data has mmap_chunk_count() * MMAP_CHUNK_TILES elements. */
+int mmap_layer_attach(struct mmap *map, const char *name,
+    enum mmap_layer_type type, void *data);
+/* id of the layer or -1 */
+int mmap_layer_find(struct mmap *map, const char *name);
+/* the MMAP_CHUNK_TILES elements of the chunk, laid out like
+ * mmap_chunk_unpack() */
+void *mmap_layer_chunk(struct mmap *map, int layer, struct mmap_chunk *chunk);
+
+/* typed access to the tiles of a layer, x and y inside the map like
+ * mmap_get(). the type has to match the one of the layer. */
+uint8_t mmap_get_u8(struct mmap *map, int layer, int x, int y);
+void mmap_set_u8(struct mmap *map, int layer, int x, int y, uint8_t v);
+uint16_t mmap_get_u16(struct mmap *map, int layer, int x, int y);
+void mmap_set_u16(struct mmap *map, int layer, int x, int y, uint16_t v);
+int32_t mmap_get_i32(struct mmap *map, int layer, int x, int y);
+void mmap_set_i32(struct mmap *map, int layer, int x, int y, int32_t v);
+float mmap_get_f32(struct mmap *map, int layer, int x, int y);
+void mmap_set_f32(struct mmap *map, int layer, int x, int y, float v);
+
+#endif
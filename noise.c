@@ -0,0 +1,74 @@
+#include <stddef.h>
+#include "noise.h"
+#include "perlin_noise2d.h"
+#include "simplex_noise2d.h"
+
+/* no FMA contraction, see CMakeLists.txt */
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+static unsigned int mix32(unsigned int h)
+{
+  h ^= h >> 16;
+  h *= 0x7feb352du;
+  h ^= h >> 15;
+  h *= 0x846ca68bu;
+  h ^= h >> 16;
+  return h;
+}
+
+unsigned int noise_hash(unsigned int seed, int x, int y)
+{
+  unsigned int h = mix32(seed + 0x9e3779b9u);
+  h = mix32(h ^ (unsigned int)x);
+  return mix32(h ^ (unsigned int)y * 0x85ebca6bu);
+}
+
+void noise_accumulate(float *out, const float *noise, int n, double weight,
+    int add)
+{
+  if (add) {
+    for (int i = 0; i < n; ++i) {
+      out[i] += noise[i] * weight;
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      out[i] = noise[i] * weight;
+    }
+  }
+}
+
+void noise_window(struct noise_params *params, struct noise_wrap *wrap,
+    int x0, int y0, int w, int h, float *out)
+{
+  switch (params->type) {
+    case NOISE_PERLIN:
+      perlin_fbm2d_window(params->octaves, params->n_octaves, params->seed,
+          wrap, x0, y0, w, h, out);
+      break;
+    case NOISE_SIMPLEX:
+      simplex_fbm2d_window(params->octaves, params->n_octaves, params->seed,
+          wrap, x0, y0, w, h, out);
+      break;
+  }
+}
+
+int noise_wraps(struct noise_params *params, struct noise_wrap *wrap)
+{
+  if (!wrap) {
+    return 1;
+  }
+  for (int i = 0; i < params->n_octaves; ++i) {
+    int d = params->octaves[i].divisor;
+    if (wrap->w % d || wrap->h % d || wrap->shift % d) {
+      return 0;
+    }
+    /* the simplex lattice lives in map coordinates, see
+     * simplex_noise2d.h */
+    if (params->type == NOISE_SIMPLEX && (wrap->h % 2 || wrap->h / 2 % d)) {
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,61 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+/* common interface of the noise engines, see perlin_noise2d.h and
+ * simplex_noise2d.h. all of them produce windows of a field that only
+ * depends on its parameters, one float per map cell, addressed in offset
+ * coordinates like mmap_set(). */
+
+enum noise_type {
+  NOISE_PERLIN,
+  NOISE_SIMPLEX
+};
+
+/* one layer of fractal noise: lattice spacing in cells and weight */
+struct noise_octave {
+  int divisor;
+  double weight;
+};
+
+/* optional periodic lattice for the window functions: the field repeats
+ * every w columns, and h rows further down it repeats shifted by shift
+ * columns, field(x, y) = field(x + w, y) = field(x + shift, y + h).
+ * 0 for w or h means no wrapping in that direction. the lattice of an
+ * engine can only follow the wrap if it fits, see noise_wraps(),
+ * otherwise the seams stay.
+ *
+ * {w, 0, 0} is a cylinder, {w, h, 0} a torus. a hex map is a torus in
+ * offset coordinates when its height is even, in map (axial) coordinates
+ * it is {w, h, -h / 2}, see map_normalize_coordinates(). */
+struct noise_wrap {
+  int w;
+  int h;
+  int shift;
+};
+
+/* octave i uses seed + i */
+struct noise_params {
+  enum noise_type type;
+  struct noise_octave *octaves;
+  int n_octaves;
+  unsigned int seed;
+};
+
+/* the w * h cells from (x0, y0) on, wrap may be NULL */
+void noise_window(struct noise_params *params, struct noise_wrap *wrap,
+    int x0, int y0, int w, int h, float *out);
+/* 1 if every octave of the engine repeats exactly like wrap */
+int noise_wraps(struct noise_params *params, struct noise_wrap *wrap);
+
+/* helpers for the engines */
+
+/* counter based hash of (seed, x, y): the same lattice point always gets
+ * the same value, no matter in which order or on which thread it is
+ * asked for */
+unsigned int noise_hash(unsigned int seed, int x, int y);
+/* out[i] = noise[i] * weight, or out[i] += noise[i] * weight when add is
+ * set. rounds to float after every octave like summing whole maps. */
+void noise_accumulate(float *out, const float *noise, int n, double weight,
+    int add);
+
+#endif
@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jobs.h"
+#include "mmap.h"
+#include "noise.h"
+#include "perlin_noise2d.h"
+#include "simplex_noise2d.h"
+#include "worldgen.h"
+
+/* noisebench: throughput of the noise entry points and output hashes
+ *
+ *   noisebench [-r reps] [-w warmup] [-s size] [-t threads]
+ *              [-g golden] [-u golden] [-f text|csv|json]
+ *
+ * every benchmark generates a size * size map warmup + reps times and
+ * reports the median in samples per second. without -s it runs 256 and
+ * 1024. the multi-threaded ones run with 1 and with -t threads (default
+ * all cpus).
+ *
+ * the hashes are FNV-1a over the output of every entry point for a few
+ * seeds and fixed sizes, independent of -s. the threaded ones are also
+ * hashed with 1 and -t threads and have to match. -u writes the hashes to
+ * a file, -g compares against such a file. the exit status is 1 if a hash
+ * differs from the golden file or between thread counts.
+ *
+ * noisebench.golden holds the hashes of the current noise, written with
+ *
+ *   noisebench -r 1 -w 0 -s 64 -u noisebench.golden
+ *
+ * from a build of CMakeLists.txt (the noise has to be built with
+ * -ffp-contract=off). the noisecheck target runs the same with -g. a
+ * change that is meant to change the noise writes the file again. */
+
+#define MAX_SIZES 8
+
+enum format {
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+};
+
+enum kind {
+  KIND_PERLIN_SEED,
+  KIND_PERLIN_FBM,
+  KIND_PERLIN_WINDOW,
+  KIND_SIMPLEX_WINDOW,
+  KIND_NOISE_PERLIN,
+  KIND_NOISE_SIMPLEX,
+  KIND_WORLDGEN,
+  KIND_WORLDGEN_SAMPLED,
+  KIND_WORLDGEN_PERCENTILE,
+  KIND_WORLDGEN_PERCENTILE_SAMPLED
+};
+
+struct entry {
+  const char *name;
+  enum kind kind;
+  /* 0 for the fractal ones, they use octaves below */
+  int divisor;
+  int threaded;
+};
+
+static struct entry entries[] = {
+  {"perlin_noise2d_seed", KIND_PERLIN_SEED, 4, 0},
+  {"perlin_noise2d_seed", KIND_PERLIN_SEED, 16, 0},
+  {"perlin_noise2d_seed", KIND_PERLIN_SEED, 64, 0},
+  {"perlin_noise2d_window", KIND_PERLIN_WINDOW, 4, 0},
+  {"perlin_noise2d_window", KIND_PERLIN_WINDOW, 16, 0},
+  {"perlin_noise2d_window", KIND_PERLIN_WINDOW, 64, 0},
+  {"simplex_noise2d_window", KIND_SIMPLEX_WINDOW, 4, 0},
+  {"simplex_noise2d_window", KIND_SIMPLEX_WINDOW, 16, 0},
+  {"simplex_noise2d_window", KIND_SIMPLEX_WINDOW, 64, 0},
+  {"perlin_fbm2d", KIND_PERLIN_FBM, 0, 0},
+  {"noise_window_perlin", KIND_NOISE_PERLIN, 0, 1},
+  {"noise_window_simplex", KIND_NOISE_SIMPLEX, 0, 1},
+  {"worldgen_generate", KIND_WORLDGEN, 0, 1},
+  {"worldgen_generate_sampled", KIND_WORLDGEN_SAMPLED, 0, 1},
+  {"worldgen_generate_percentile", KIND_WORLDGEN_PERCENTILE, 0, 1},
+  {"worldgen_generate_percentile_sampled", KIND_WORLDGEN_PERCENTILE_SAMPLED, 0, 1},
+};
+
+/* the octaves hextest uses */
+static struct noise_octave octaves[] = {
+  {64, 0.7}, {32, 0.6}, {16, 0.4}, {8, 0.3}, {4, 0.2}
+};
+#define N_OCTAVES (int)(sizeof(octaves) / sizeof(*octaves))
+
+/* hextest's tiles, and the row step for the sampled worldgen mode */
+static const double limits[] = {.6, 0.90};
+#define SAMPLE_STEP 8
+
+static unsigned int hash_seeds[] = {0, 1, 1234};
+/* one size every divisor fits, one that leaves remainders */
+static int hash_sizes[][2] = {{256, 256}, {200, 136}};
+
+struct run {
+  struct entry *entry;
+  int w;
+  int h;
+  unsigned int seed;
+  int threads;
+  float *out;
+  struct mmap *map;
+};
+
+/* noise_window() in bands of rows on the job pool */
+#define BAND_ROWS 32
+
+static void band_job(void *data, int band)
+{
+  struct run *run = data;
+  struct noise_params params = {
+    run->entry->kind == KIND_NOISE_PERLIN ? NOISE_PERLIN : NOISE_SIMPLEX,
+    octaves, N_OCTAVES, run->seed
+  };
+  struct noise_wrap wrap = {run->w, run->h, 0};
+  int y0 = band * BAND_ROWS;
+  int rows = run->h - y0 < BAND_ROWS ? run->h - y0 : BAND_ROWS;
+  noise_window(&params, noise_wraps(&params, &wrap) ? &wrap : NULL,
+      0, y0, run->w, rows, run->out + y0 * run->w);
+}
+
+static void run_entry(struct run *run)
+{
+  struct entry *e = run->entry;
+  int w = run->w;
+  int h = run->h;
+  switch (e->kind) {
+    case KIND_PERLIN_SEED:
+      perlin_noise2d_seed(w, h, e->divisor, run->seed, run->out);
+      break;
+    case KIND_PERLIN_FBM:
+      perlin_fbm2d(w, h, octaves, N_OCTAVES, run->seed, run->out);
+      break;
+    case KIND_PERLIN_WINDOW:
+      perlin_noise2d_window(e->divisor, run->seed, NULL, -w / 2, -h / 2,
+          w, h, run->out);
+      break;
+    case KIND_SIMPLEX_WINDOW:
+      simplex_noise2d_window(e->divisor, run->seed, NULL, -w / 2, -h / 2,
+          w, h, run->out);
+      break;
+    case KIND_NOISE_PERLIN:
+    case KIND_NOISE_SIMPLEX:
+      jobs_run(run->threads, (h + BAND_ROWS - 1) / BAND_ROWS, band_job, run);
+      break;
+    case KIND_WORLDGEN:
+    case KIND_WORLDGEN_SAMPLED:
+    case KIND_WORLDGEN_PERCENTILE:
+    case KIND_WORLDGEN_PERCENTILE_SAMPLED: {
+      struct noise_params noise = {NOISE_PERLIN, octaves, N_OCTAVES, run->seed};
+      struct worldgen_params params = {
+        &noise, limits, 2,
+        e->kind == KIND_WORLDGEN_SAMPLED
+            || e->kind == KIND_WORLDGEN_PERCENTILE_SAMPLED ? SAMPLE_STEP : 0,
+        e->kind == KIND_WORLDGEN_PERCENTILE
+            || e->kind == KIND_WORLDGEN_PERCENTILE_SAMPLED, NULL
+      };
+      worldgen_generate(run->map, &params, run->threads);
+      break;
+    }
+  }
+}
+
+/* fnv-1a, 64 bit */
+static unsigned long long hash_bytes(const void *data, size_t n)
+{
+  const unsigned char *p = data;
+  unsigned long long h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < n; ++i) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+/* over the tiles in row-major order, whatever the storage order */
+static unsigned long long hash_map(struct mmap *map)
+{
+  int *tiles = malloc(map->w * map->h * sizeof(*tiles));
+  for (int y = 0; y < map->h; ++y) {
+    mmap_get_row(map, 0, y, map->w, tiles + y * map->w);
+  }
+  unsigned long long h = hash_bytes(tiles, map->w * map->h * sizeof(*tiles));
+  free(tiles);
+  return h;
+}
+
+static unsigned long long run_hash(struct run *run)
+{
+  /* start from a known state, perlin_noise2d_seed() leaves remainders */
+  memset(run->out, 0, run->w * run->h * sizeof(*run->out));
+  run_entry(run);
+  if (run->entry->kind == KIND_WORLDGEN
+      || run->entry->kind == KIND_WORLDGEN_SAMPLED
+      || run->entry->kind == KIND_WORLDGEN_PERCENTILE
+      || run->entry->kind == KIND_WORLDGEN_PERCENTILE_SAMPLED) {
+    return hash_map(run->map);
+  }
+  return hash_bytes(run->out, run->w * run->h * sizeof(*run->out));
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+/* returns the median samples per second */
+static double bench_run(struct run *run, int reps, int warmup)
+{
+  double times[reps];
+  for (int i = 0; i < warmup; ++i) {
+    run_entry(run);
+  }
+  for (int i = 0; i < reps; ++i) {
+    double start = now();
+    run_entry(run);
+    times[i] = now() - start;
+  }
+  qsort(times, reps, sizeof(*times), compare_double);
+  return (double)run->w * run->h / times[reps / 2];
+}
+
+static void case_name(char *buf, size_t n, struct entry *e, int w, int h)
+{
+  if (e->divisor) {
+    snprintf(buf, n, "%s/%dx%d/d%d", e->name, w, h, e->divisor);
+  } else {
+    snprintf(buf, n, "%s/%dx%d", e->name, w, h);
+  }
+}
+
+struct hash_result {
+  char name[96];
+  unsigned long long hash;
+  /* 0 ok, 1 differs between thread counts, 2 differs from golden,
+   * 3 missing in golden */
+  int status;
+};
+
+static const char *status_names[] = {"ok", "threads", "golden", "missing"};
+
+/* looks name up in a file of "name hash" lines, returns 0 if it is not
+ * there */
+static int golden_lookup(FILE *f, const char *name, unsigned long long *hash)
+{
+  char line[256];
+  char key[128];
+  unsigned long long value;
+  rewind(f);
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "%127s %llx", key, &value) == 2 && !strcmp(key, name)) {
+      *hash = value;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-r reps] [-w warmup] [-s size] [-t threads] "
+      "[-g golden] [-u golden] [-f text|csv|json]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  int reps = 5;
+  int warmup = 1;
+  int sizes[MAX_SIZES];
+  int n_sizes = 0;
+  int threads = jobs_cpu_count();
+  const char *golden = NULL;
+  const char *update = NULL;
+  enum format format = FORMAT_TEXT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:w:s:t:g:u:f:h")) != -1) {
+    switch (opt) {
+      case 'r': reps = atoi(optarg); break;
+      case 'w': warmup = atoi(optarg); break;
+      case 's':
+        if (n_sizes == MAX_SIZES) {
+          usage(argv[0]);
+          return 2;
+        }
+        sizes[n_sizes++] = atoi(optarg);
+        if (sizes[n_sizes - 1] < 1) {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 't': threads = atoi(optarg); break;
+      case 'g': golden = optarg; break;
+      case 'u': update = optarg; break;
+      case 'f':
+        if (!strcmp(optarg, "csv")) {
+          format = FORMAT_CSV;
+        } else if (!strcmp(optarg, "json")) {
+          format = FORMAT_JSON;
+        } else if (!strcmp(optarg, "text")) {
+          format = FORMAT_TEXT;
+        } else {
+          usage(argv[0]);
+          return 2;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (reps < 1 || warmup < 0 || threads < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (!n_sizes) {
+    sizes[n_sizes++] = 256;
+    sizes[n_sizes++] = 1024;
+  }
+
+  FILE *golden_file = NULL;
+  if (golden && !(golden_file = fopen(golden, "r"))) {
+    perror(golden);
+    return 2;
+  }
+
+  int n_entries = sizeof(entries) / sizeof(*entries);
+  int n_hash_seeds = sizeof(hash_seeds) / sizeof(*hash_seeds);
+  int n_hash_sizes = sizeof(hash_sizes) / sizeof(*hash_sizes);
+  int n_hashes = n_entries * n_hash_seeds * n_hash_sizes;
+  struct hash_result *hashes = calloc(n_hashes, sizeof(*hashes));
+  int failed = 0;
+
+  /* hashes first, they do not depend on the options */
+  int k = 0;
+  for (int s = 0; s < n_hash_sizes; ++s) {
+    int w = hash_sizes[s][0];
+    int h = hash_sizes[s][1];
+    float *out = malloc(w * h * sizeof(*out));
+    struct mmap map;
+    mmap_init(&map, w, h, 0);
+    for (int i = 0; i < n_entries; ++i) {
+      for (int j = 0; j < n_hash_seeds; ++j) {
+        struct run run = {&entries[i], w, h, hash_seeds[j], 1, out, &map};
+        struct hash_result *r = &hashes[k++];
+        char name[80];
+        case_name(name, sizeof(name), &entries[i], w, h);
+        snprintf(r->name, sizeof(r->name), "%s/s%u", name, hash_seeds[j]);
+        r->hash = run_hash(&run);
+        if (entries[i].threaded) {
+          run.threads = threads;
+          if (run_hash(&run) != r->hash) {
+            r->status = 1;
+          }
+        }
+        unsigned long long expected;
+        if (!r->status && golden_file) {
+          if (!golden_lookup(golden_file, r->name, &expected)) {
+            r->status = 3;
+          } else if (expected != r->hash) {
+            r->status = 2;
+          }
+        }
+        failed |= r->status != 0;
+      }
+    }
+    mmap_free(&map);
+    free(out);
+  }
+  if (golden_file) {
+    fclose(golden_file);
+  }
+  if (update) {
+    FILE *f = fopen(update, "w");
+    if (!f) {
+      perror(update);
+      return 2;
+    }
+    for (int i = 0; i < n_hashes; ++i) {
+      fprintf(f, "%s %016llx\n", hashes[i].name, hashes[i].hash);
+    }
+    fclose(f);
+  }
+
+  if (format == FORMAT_CSV) {
+    puts("kind,name,threads,msamples_per_s,ns_per_sample,hash,status");
+  } else if (format == FORMAT_JSON) {
+    printf("{\n  \"reps\": %d,\n  \"warmup\": %d,\n  \"threads\": %d,\n"
+        "  \"benchmarks\": [\n", reps, warmup, threads);
+  } else {
+    printf("%-40s %7s %10s %10s\n", "benchmark", "threads", "Msample/s",
+        "ns/sample");
+  }
+
+  int first = 1;
+  for (int s = 0; s < n_sizes; ++s) {
+    int size = sizes[s];
+    float *out = malloc(size * size * sizeof(*out));
+    struct mmap map;
+    mmap_init(&map, size, size, 0);
+    for (int i = 0; i < n_entries; ++i) {
+      int thread_counts[2] = {1, threads};
+      int n_counts = entries[i].threaded && threads > 1 ? 2 : 1;
+      for (int c = 0; c < n_counts; ++c) {
+        int t = thread_counts[c];
+        struct run run = {&entries[i], size, size, 1, t, out, &map};
+        char name[80];
+        case_name(name, sizeof(name), &entries[i], size, size);
+        double samples = bench_run(&run, reps, warmup);
+        if (format == FORMAT_CSV) {
+          printf("bench,%s,%d,%.2f,%.3f,,\n", name, t, samples * 1e-6,
+              1e9 / samples);
+        } else if (format == FORMAT_JSON) {
+          printf("%s    {\"name\": \"%s\", \"threads\": %d, "
+              "\"msamples_per_s\": %.2f, \"ns_per_sample\": %.3f}",
+              first ? "" : ",\n", name, t, samples * 1e-6, 1e9 / samples);
+        } else {
+          printf("%-40s %7d %10.2f %10.3f\n", name, t, samples * 1e-6,
+              1e9 / samples);
+        }
+        first = 0;
+      }
+    }
+    mmap_free(&map);
+    free(out);
+  }
+
+  if (format == FORMAT_JSON) {
+    printf("\n  ],\n  \"hashes\": [\n");
+  } else if (format == FORMAT_TEXT) {
+    printf("\n%-40s %16s %8s\n", "hash", "fnv1a64", "status");
+  }
+  for (int i = 0; i < n_hashes; ++i) {
+    struct hash_result *r = &hashes[i];
+    if (format == FORMAT_CSV) {
+      printf("hash,%s,,,,%016llx,%s\n", r->name, r->hash,
+          status_names[r->status]);
+    } else if (format == FORMAT_JSON) {
+      printf("    {\"name\": \"%s\", \"hash\": \"%016llx\", \"status\": \"%s\"}%s\n",
+          r->name, r->hash, status_names[r->status],
+          i + 1 < n_hashes ? "," : "");
+    } else {
+      printf("%-40s %016llx %8s\n", r->name, r->hash, status_names[r->status]);
+    }
+  }
+  if (format == FORMAT_JSON) {
+    printf("  ],\n  \"ok\": %s\n}\n", failed ? "false" : "true");
+  }
+
+  free(hashes);
+  return failed ? 1 : 0;
+}
@@ -1,171 +1,371 @@
-#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "perlin_noise2d.h"
 
-struct map {
-  int w;
-  int h;
-  unsigned char *map;
+/* no FMA contraction, clang honors this, gcc gets -ffp-contract=off from
+ * CMakeLists.txt */
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+struct vector {
+  float x;
+  float y;
 };
 
-static void map_init(struct map *map, int w, int h)
+static void vector_normalize(struct vector *out)
 {
-  map->w = w;
-  map->h = h;
-  map->map = calloc(1, w * h);
+  float length = sqrtf(out->x * out->x + out->y * out->y);
+  out->x /= length;
+  out->y /= length;
 }
 
-static void map_free(struct map *map)
+static void vector_from_int(int v, struct vector *out)
 {
-  free(map->map);
+  out->x = (float)(v & 15);
+  out->y = (float)((v >> 4) & 15);
+  out->x -= 7.5;
+  out->y -= 7.5;
+  vector_normalize(out);
 }
 
-static int map_normalize_x(struct map* map, int x)
-{
-  while (x < 0) {
-    x = x + map->w;
-  }
-  while (x >= map->w) {
-    x = x - map->w;
-  }
-  return x;
+static float lerp(float v0, float v1, float t) {
+  return (1.0 - t) * v0 + t * v1;
 }
 
-static int map_get(struct map *map, int x, int y)
+static float fade(float t) {
+    return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+}
+
+/* everything in the pixel loop that only depends on the position inside
+ * a lattice cell, for sub = 0 .. divisor - 1 */
+struct perlin_tables {
+  int divisor;
+  float *fade;
+  float *pos;
+  float *pos_len;
+};
+
+static void perlin_tables_init(struct perlin_tables *t, int divisor)
 {
-  if (y < 0 || y >= map->h) {
-    return -1;
+  float len = sqrtf(2);
+  t->divisor = divisor;
+  t->fade = malloc(3 * divisor * sizeof(*t->fade));
+  t->pos = t->fade + divisor;
+  t->pos_len = t->pos + divisor;
+  for (int sub = 0; sub < divisor; ++sub) {
+    float position = sub / (float)(divisor - 1);
+    t->fade[sub] = fade(position);
+    t->pos[sub] = position * len;
+    t->pos_len[sub] = t->pos[sub] - len;
   }
-  x = map_normalize_x(map, x);
-  return map->map[x + y * map->w];
 }
 
-static int map_set(struct map *map, int x, int y, int v)
+static void perlin_tables_free(struct perlin_tables *t)
 {
-  if ( y < 0 || y >= map->h) {
-    return -1;
-  }
-  x = map_normalize_x(map, x);
-  map->map[x + y * map->w] = v;
-  return 0;
+  free(t->fade);
 }
 
-static void map_print(struct map *map)
+/* pixels sub_x .. sub_x + n - 1 of row sub_y of the lattice cell with the
+ * corner vectors a (top left), b (top right), c (bottom right) and d
+ * (bottom left).
+ *
+ * lerp() computes (1.0 - t) * v0 in double but t * v1 in float, the vector
+ * versions keep exactly that mix so the output is bit identical to the
+ * scalar loop, as long as neither is contracted into an FMA (see the
+ * pragma at the top). */
+static void perlin_cell_row(struct perlin_tables *t, struct vector *a,
+    struct vector *b, struct vector *c, struct vector *d,
+    int sub_x, int sub_y, int n, float *out)
 {
-  for (int y = 0; y < map->h; ++y) {
-    for (int x = 0; x < map->w; ++x) {
-      int v = map->map[y * map->w + x];
-      fprintf(stdout, "%x", v);
+  float py = t->pos[sub_y];
+  float py_len = t->pos_len[sub_y];
+  float vertical_t = t->fade[sub_y];
+  const float *fade_x = t->fade + sub_x;
+  const float *pos = t->pos + sub_x;
+  const float *pos_len = t->pos_len + sub_x;
+  int i = 0;
+
+#if defined(__AVX__)
+  __m256 ax = _mm256_set1_ps(a->x), ay_py = _mm256_set1_ps(a->y * py);
+  __m256 bx = _mm256_set1_ps(b->x), by_py = _mm256_set1_ps(b->y * py);
+  __m256 cx = _mm256_set1_ps(c->x), cy_py = _mm256_set1_ps(c->y * py_len);
+  __m256 dx = _mm256_set1_ps(d->x), dy_py = _mm256_set1_ps(d->y * py_len);
+  __m256 vt = _mm256_set1_ps(vertical_t);
+  __m256d vt1 = _mm256_set1_pd(1.0 - vertical_t);
+  __m256d one = _mm256_set1_pd(1.0);
+  for (; i + 8 <= n; i += 8) {
+    __m256 px = _mm256_loadu_ps(pos + i);
+    __m256 px_len = _mm256_loadu_ps(pos_len + i);
+    __m256 ht = _mm256_loadu_ps(fade_x + i);
+    __m256 dot_a = _mm256_add_ps(_mm256_mul_ps(ax, px), ay_py);
+    __m256 dot_b = _mm256_add_ps(_mm256_mul_ps(bx, px_len), by_py);
+    __m256 dot_c = _mm256_add_ps(_mm256_mul_ps(cx, px_len), cy_py);
+    __m256 dot_d = _mm256_add_ps(_mm256_mul_ps(dx, px), dy_py);
+    __m256 ht_b = _mm256_mul_ps(ht, dot_b);
+    __m256 ht_c = _mm256_mul_ps(ht, dot_c);
+    __m128 dot_ab[2];
+    __m128 dot_dc[2];
+#define HALF(v, h) _mm256_cvtps_pd(h ? _mm256_extractf128_ps(v, 1) : _mm256_castps256_ps128(v))
+    for (int h = 0; h < 2; ++h) {
+      __m256d ht1 = _mm256_sub_pd(one, HALF(ht, h));
+      dot_ab[h] = _mm256_cvtpd_ps(_mm256_add_pd(
+            _mm256_mul_pd(ht1, HALF(dot_a, h)), HALF(ht_b, h)));
+      dot_dc[h] = _mm256_cvtpd_ps(_mm256_add_pd(
+            _mm256_mul_pd(ht1, HALF(dot_d, h)), HALF(ht_c, h)));
+    }
+    __m256 ab = _mm256_insertf128_ps(_mm256_castps128_ps256(dot_ab[0]), dot_ab[1], 1);
+    __m256 vt_dc = _mm256_mul_ps(vt, _mm256_insertf128_ps(
+          _mm256_castps128_ps256(dot_dc[0]), dot_dc[1], 1));
+    for (int h = 0; h < 2; ++h) {
+      _mm_storeu_ps(out + i + 4 * h, _mm256_cvtpd_ps(_mm256_add_pd(
+              _mm256_mul_pd(vt1, HALF(ab, h)), HALF(vt_dc, h))));
+    }
+#undef HALF
+  }
+#elif defined(__SSE2__)
+  __m128 ax = _mm_set1_ps(a->x), ay_py = _mm_set1_ps(a->y * py);
+  __m128 bx = _mm_set1_ps(b->x), by_py = _mm_set1_ps(b->y * py);
+  __m128 cx = _mm_set1_ps(c->x), cy_py = _mm_set1_ps(c->y * py_len);
+  __m128 dx = _mm_set1_ps(d->x), dy_py = _mm_set1_ps(d->y * py_len);
+  __m128 vt = _mm_set1_ps(vertical_t);
+  __m128d vt1 = _mm_set1_pd(1.0 - vertical_t);
+  __m128d one = _mm_set1_pd(1.0);
+  for (; i + 4 <= n; i += 4) {
+    __m128 px = _mm_loadu_ps(pos + i);
+    __m128 px_len = _mm_loadu_ps(pos_len + i);
+    __m128 ht = _mm_loadu_ps(fade_x + i);
+    __m128 dot_a = _mm_add_ps(_mm_mul_ps(ax, px), ay_py);
+    __m128 dot_b = _mm_add_ps(_mm_mul_ps(bx, px_len), by_py);
+    __m128 dot_c = _mm_add_ps(_mm_mul_ps(cx, px_len), cy_py);
+    __m128 dot_d = _mm_add_ps(_mm_mul_ps(dx, px), dy_py);
+    __m128 ht_b = _mm_mul_ps(ht, dot_b);
+    __m128 ht_c = _mm_mul_ps(ht, dot_c);
+    __m128 dot_ab[2];
+    __m128 dot_dc[2];
+    __m128 result[2];
+#define HALF(v, h) _mm_cvtps_pd(h ? _mm_movehl_ps(v, v) : v)
+    for (int h = 0; h < 2; ++h) {
+      __m128d ht1 = _mm_sub_pd(one, HALF(ht, h));
+      dot_ab[h] = _mm_cvtpd_ps(_mm_add_pd(
+            _mm_mul_pd(ht1, HALF(dot_a, h)), HALF(ht_b, h)));
+      dot_dc[h] = _mm_cvtpd_ps(_mm_add_pd(
+            _mm_mul_pd(ht1, HALF(dot_d, h)), HALF(ht_c, h)));
     }
-    fputs("\n", stdout);
+    __m128 ab = _mm_movelh_ps(dot_ab[0], dot_ab[1]);
+    __m128 vt_dc = _mm_mul_ps(vt, _mm_movelh_ps(dot_dc[0], dot_dc[1]));
+    for (int h = 0; h < 2; ++h) {
+      result[h] = _mm_cvtpd_ps(_mm_add_pd(
+            _mm_mul_pd(vt1, HALF(ab, h)), HALF(vt_dc, h)));
+    }
+#undef HALF
+    _mm_storeu_ps(out + i, _mm_movelh_ps(result[0], result[1]));
+  }
+#endif
+  for (; i < n; ++i) {
+    float dot_a = a->x * pos[i] + a->y * py;
+    float dot_b = b->x * pos_len[i] + b->y * py;
+    float dot_c = c->x * pos_len[i] + c->y * py_len;
+    float dot_d = d->x * pos[i] + d->y * py_len;
+    float dot_ab = lerp(dot_a, dot_b, fade_x[i]);
+    float dot_dc = lerp(dot_d, dot_c, fade_x[i]);
+    out[i] = lerp(dot_ab, dot_dc, vertical_t);
   }
 }
 
-static void map_random(struct map *map)
+void perlin_noise2d(int w, int h, int divisor, float *out)
 {
-  int max = map->w * map->h;
-  for (int i = 0; i < max; ++i) {
-    map->map[i] = random() & 255;
-  }
+  perlin_noise2d_seed(w, h, divisor, random(), out);
 }
 
-struct vector {
-  float x;
-  float y;
+static int floor_div(int v, int d)
+{
+  return v >= 0 ? v / d : -((d - 1 - v) / d);
+}
+
+/* one octave evaluated for the pixel columns x0 .. x0 + w - 1, row by
+ * row. the lattice is unbounded unless wrapped, see struct noise_wrap,
+ * the periods and shift are in lattice cells. top and bottom point into
+ * vectors and hold the corner vectors of cell row cell_y and the row
+ * below it. */
+struct perlin_layer {
+  struct perlin_tables tables;
+  unsigned int seed;
+  int period_x;
+  int period_y;
+  int shift_x;
+  int x0;
+  int w;
+  int cell_x0;
+  int cells;
+  int cell_y;
+  int valid;
+  struct vector *vectors;
+  struct vector *top;
+  struct vector *bottom;
 };
 
-static void vector_normalize(struct vector *out)
+static void perlin_layer_init(struct perlin_layer *layer, int divisor,
+    unsigned int seed, struct noise_wrap *wrap, int x0, int w)
 {
-  float length = sqrtf(out->x * out->x + out->y * out->y);
-  out->x /= length;
-  out->y /= length;
+  layer->seed = seed;
+  layer->period_x = wrap ? wrap->w / divisor : 0;
+  layer->period_y = wrap ? wrap->h / divisor : 0;
+  layer->shift_x = wrap ? wrap->shift / divisor : 0;
+  layer->x0 = x0;
+  layer->w = w;
+  layer->cell_x0 = floor_div(x0, divisor);
+  layer->cells = w > 0 ? floor_div(x0 + w - 1, divisor) - layer->cell_x0 + 1 : 0;
+  layer->valid = 0;
+  layer->vectors = malloc(2 * (layer->cells + 1) * sizeof(*layer->vectors));
+  layer->top = layer->vectors;
+  layer->bottom = layer->top + layer->cells + 1;
+  perlin_tables_init(&layer->tables, divisor);
 }
 
-static void vector_from_int(int v, struct vector *out)
+static void perlin_layer_free(struct perlin_layer *layer)
 {
-  out->x = (float)(v & 15);
-  out->y = (float)((v >> 4) & 15);
-  out->x -= 7.5;
-  out->y -= 7.5;
-  vector_normalize(out);
+  perlin_tables_free(&layer->tables);
+  free(layer->vectors);
 }
 
-static void perlin_map_get(struct map *map, int x, int y,
-    struct vector *a, struct vector *b, struct vector *c, struct vector *d)
+/* wraps once per row, along the row cx only has to be reset at period_x */
+static void lattice_row(struct perlin_layer *layer, int cell_y, struct vector *out)
 {
-  vector_from_int(map_get(map, x + 0, y + 0), a);
-  vector_from_int(map_get(map, x + 1, y + 0), b);
-  vector_from_int(map_get(map, x + 1, y + 1), c);
-  vector_from_int(map_get(map, x + 0, y + 1), d);
+  int cx = layer->cell_x0;
+  int cy = cell_y;
+  if (layer->period_y) {
+    int k = floor_div(cy, layer->period_y);
+    cy -= k * layer->period_y;
+    cx -= k * layer->shift_x;
+  }
+  if (layer->period_x) {
+    cx -= floor_div(cx, layer->period_x) * layer->period_x;
+  }
+  for (int i = 0; i <= layer->cells; ++i) {
+    vector_from_int(noise_hash(layer->seed, cx, cy) & 255, &out[i]);
+    if (++cx == layer->period_x) {
+      cx = 0;
+    }
+  }
 }
 
-static float dot_product(struct vector* a, struct vector *b)
+/* pixel row y into out[0 .. w - 1] */
+static void perlin_layer_row(struct perlin_layer *layer, int y, float *out)
 {
-  return a->x * b->x + a->y * b->y;
+  int divisor = layer->tables.divisor;
+  int cell_y = floor_div(y, divisor);
+  if (!layer->valid || cell_y != layer->cell_y) {
+    if (layer->valid && cell_y == layer->cell_y + 1) {
+      struct vector *tmp = layer->top;
+      layer->top = layer->bottom;
+      layer->bottom = tmp;
+    } else {
+      lattice_row(layer, cell_y, layer->top);
+    }
+    lattice_row(layer, cell_y + 1, layer->bottom);
+    layer->cell_y = cell_y;
+    layer->valid = 1;
+  }
+  int sub_y = y - cell_y * divisor;
+  int sub_x = layer->x0 - layer->cell_x0 * divisor;
+  int done = 0;
+  for (int i = 0; i < layer->cells; ++i) {
+    int n = divisor - sub_x;
+    if (n > layer->w - done) {
+      n = layer->w - done;
+    }
+    perlin_cell_row(&layer->tables, &layer->top[i], &layer->top[i + 1],
+        &layer->bottom[i + 1], &layer->bottom[i], sub_x, sub_y, n, out + done);
+    done += n;
+    sub_x = 0;
+  }
 }
 
-static float lerp(float v0, float v1, float t) {
-  return (1.0 - t) * v0 + t * v1;
+/* the w * h maps use a lattice of w / divisor columns that wraps in x and
+ * only fill the full cells, anything right or below is left alone */
+void perlin_noise2d_seed(int w, int h, int divisor, unsigned int seed, float *out)
+{
+  struct perlin_layer layer;
+  struct noise_wrap wrap = {w, 0, 0};
+  perlin_layer_init(&layer, divisor, seed, &wrap, 0, w / divisor * divisor);
+  for (int y = 0; y < h / divisor * divisor; ++y) {
+    perlin_layer_row(&layer, y, out + y * w);
+  }
+  perlin_layer_free(&layer);
 }
 
-static float fade(float t) {
-    return t * t * t * (t * (t * 6.0 - 15.0) + 10.0);
+void perlin_fbm2d(int w, int h, struct noise_octave *octaves, int n_octaves,
+    unsigned int seed, float *out)
+{
+  perlin_fbm2d_rows(w, h, octaves, n_octaves, seed, 0, h, out);
 }
 
-void perlin_noise2d(int w, int h, int divisor, float *out)
+void perlin_fbm2d_rows(int w, int h, struct noise_octave *octaves,
+    int n_octaves, unsigned int seed, int y0, int y1, float *out)
 {
-  /* first initialize a new map with all perlin vector data */
-  struct map vector_data;
-  int vector_map_width = w / divisor;
-  int vector_map_height = h / divisor;
-  map_init(&vector_data, vector_map_width, vector_map_height + 1);
-  map_random(&vector_data);
-  for (int y = 0; y < vector_map_height; ++y) {
-    for (int x = 0; x < vector_map_width; ++x) {
-      struct vector a;
-      struct vector b;
-      struct vector c;
-      struct vector d;
-      perlin_map_get(&vector_data, x, y, &a, &b, &c, &d);
-      for (int sub_y = 0; sub_y < divisor; ++sub_y) {
-        for (int sub_x = 0; sub_x < divisor; ++sub_x) {
-          struct vector position;
-          position.x = sub_x / (float)(divisor - 1);
-          position.y = sub_y / (float)(divisor - 1);
-          float horizontal_t = fade(position.x);
-          float vertical_t = fade(position.y);
-          float len = sqrtf(2);
-          position.x *= len;
-          position.y *= len;
-          struct vector position_a;
-          struct vector position_b;
-          struct vector position_c;
-          struct vector position_d;
-          position_a.x = position.x;
-          position_a.y = position.y;
-
-          position_b.x = position.x - len;
-          position_b.y = position.y;
-
-          position_c.x = position.x - len;
-          position_c.y = position.y - len;
-
-          position_d.x = position.x;
-          position_d.y = position.y - len;
-
-          float dot_a = dot_product(&a, &position_a);
-          float dot_b = dot_product(&b, &position_b);
-          float dot_c = dot_product(&c, &position_c);
-          float dot_d = dot_product(&d, &position_d);
-
-          float dot_ab = lerp(dot_a, dot_b, horizontal_t);
-          float dot_dc = lerp(dot_d, dot_c, horizontal_t);
-          float result = lerp(dot_ab, dot_dc, vertical_t);
-          //map_set(map, x * divisor + sub_x, y * divisor + sub_y, (result + 1.0) / 2.0 * 10);
-          out[x * divisor + sub_x + (y * divisor + sub_y) * w] = result;
-        }
+  struct perlin_layer *layers = malloc(n_octaves * sizeof(*layers));
+  float *row = malloc(w * sizeof(*row));
+  struct noise_wrap wrap = {w, 0, 0};
+  for (int i = 0; i < n_octaves; ++i) {
+    perlin_layer_init(&layers[i], octaves[i].divisor, seed + i, &wrap, 0,
+        w / octaves[i].divisor * octaves[i].divisor);
+  }
+  for (int y = y0; y < y1; ++y) {
+    for (int i = 0; i < n_octaves; ++i) {
+      int n = 0;
+      /* pixels outside the lattice of an octave get nothing from it */
+      if (y < h / octaves[i].divisor * octaves[i].divisor) {
+        perlin_layer_row(&layers[i], y, row);
+        n = layers[i].w;
+      }
+      for (int x = n; x < w; ++x) {
+        row[x] = 0;
       }
+      noise_accumulate(out + (y - y0) * w, row, w, octaves[i].weight, i > 0);
+    }
+  }
+  for (int i = 0; i < n_octaves; ++i) {
+    perlin_layer_free(&layers[i]);
+  }
+  free(row);
+  free(layers);
+}
+
+void perlin_noise2d_window(int divisor, unsigned int seed,
+    struct noise_wrap *wrap, int x0, int y0, int w, int h, float *out)
+{
+  struct perlin_layer layer;
+  perlin_layer_init(&layer, divisor, seed, wrap, x0, w);
+  for (int y = 0; y < h; ++y) {
+    perlin_layer_row(&layer, y0 + y, out + y * w);
+  }
+  perlin_layer_free(&layer);
+}
+
+void perlin_fbm2d_window(struct noise_octave *octaves, int n_octaves,
+    unsigned int seed, struct noise_wrap *wrap, int x0, int y0, int w, int h,
+    float *out)
+{
+  struct perlin_layer *layers = malloc(n_octaves * sizeof(*layers));
+  float *row = malloc(w * sizeof(*row));
+  for (int i = 0; i < n_octaves; ++i) {
+    perlin_layer_init(&layers[i], octaves[i].divisor, seed + i, wrap, x0, w);
+  }
+  for (int y = 0; y < h; ++y) {
+    for (int i = 0; i < n_octaves; ++i) {
+      perlin_layer_row(&layers[i], y0 + y, row);
+      noise_accumulate(out + y * w, row, w, octaves[i].weight, i > 0);
     }
   }
-  map_free(&vector_data);
+  for (int i = 0; i < n_octaves; ++i) {
+    perlin_layer_free(&layers[i]);
+  }
+  free(row);
+  free(layers);
 }
@@ -1,2 +1,34 @@
+#ifndef PERLIN_NOISE2D_H
+#define PERLIN_NOISE2D_H
+
+#include "noise.h"
+
+/* perlin_noise2d() draws its lattice from random(); perlin_noise2d_seed()
+ * derives it from seed only, so it is reentrant and gives the same output
+ * for the same arguments on any thread */
 void perlin_noise2d(int w, int h, int divisor, float *out);
+void perlin_noise2d_seed(int w, int h, int divisor, unsigned int seed, float *out);
+
+/* sums the octaves, each scaled by its weight, into out (w * h floats).
+ * octave i uses seed + i, so this equals calling perlin_noise2d_seed() per
+ * octave and adding the maps up, without the intermediate maps. */
+void perlin_fbm2d(int w, int h, struct noise_octave *octaves, int n_octaves,
+    unsigned int seed, float *out);
+/* only rows y0 .. y1 - 1 of the same w * h map, out holds (y1 - y0) * w
+ * floats. any split into row ranges gives the same values. */
+void perlin_fbm2d_rows(int w, int h, struct noise_octave *octaves,
+    int n_octaves, unsigned int seed, int y0, int y1, float *out);
+
+/* windows of a noise field: out gets the w * h pixels from (x0, y0) on.
+ * the field only depends on seed, divisor (and octaves) and wrap, which
+ * may be NULL for an unbounded field. the lattice follows wrap if w, h
+ * and shift are multiples of every divisor. neighbouring windows fit
+ * together without seams and any window can be produced on its own, in
+ * any order or on any thread. */
+void perlin_noise2d_window(int divisor, unsigned int seed,
+    struct noise_wrap *wrap, int x0, int y0, int w, int h, float *out);
+void perlin_fbm2d_window(struct noise_octave *octaves, int n_octaves,
+    unsigned int seed, struct noise_wrap *wrap, int x0, int y0, int w, int h,
+    float *out);
 
+#endif
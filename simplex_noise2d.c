@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "hex.h"
+#include "simplex_noise2d.h"
+
+/* no FMA contraction, see CMakeLists.txt */
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+/* a lattice point (i, j) is map cell (i * divisor, j * divisor). with the
+ * cell offset (fq, fr) inside the lattice cell in units of the lattice
+ * spacing the sample sits at (fq + fr / 2, fr * sqrt(3) / 2) relative to
+ * (i, j), (i + 1, j) is at (1, 0), (i, j + 1) at (1 / 2, sqrt(3) / 2) and
+ * (i + 1, j + 1) at (3 / 2, sqrt(3) / 2). fq + fr < 1 is the triangle
+ * (i, j), (i + 1, j), (i, j + 1), otherwise (i + 1, j), (i, j + 1),
+ * (i + 1, j + 1).
+ *
+ * the falloff radius is the height of a triangle, so a corner's
+ * contribution is 0 before the sample reaches a triangle that does not
+ * contain the corner. */
+#define SQRT3_2 0.8660254f
+#define RADIUS2 0.75f
+#define SCALE 16.0f
+
+/* 12 directions, 30 degrees apart */
+static const float gradients[12][2] = {
+  {1, 0}, {SQRT3_2, 0.5f}, {0.5f, SQRT3_2},
+  {0, 1}, {-0.5f, SQRT3_2}, {-SQRT3_2, 0.5f},
+  {-1, 0}, {-SQRT3_2, -0.5f}, {-0.5f, -SQRT3_2},
+  {0, -1}, {0.5f, -SQRT3_2}, {SQRT3_2, -0.5f}
+};
+
+struct gradient {
+  float x;
+  float y;
+};
+
+/* one octave, periods and shift in lattice cells of map coordinates */
+struct simplex_layer {
+  int divisor;
+  float inv_divisor;
+  unsigned int seed;
+  int period_i;
+  int period_j;
+  int shift_i;
+};
+
+static int floor_div(int v, int d)
+{
+  return v >= 0 ? v / d : -((d - 1 - v) / d);
+}
+
+/* wrap is in offset coordinates, moving h rows down in map coordinates
+ * moves x by another -h / 2 */
+static void simplex_layer_init(struct simplex_layer *layer, int divisor,
+    unsigned int seed, struct noise_wrap *wrap)
+{
+  layer->divisor = divisor;
+  layer->inv_divisor = 1.0f / divisor;
+  layer->seed = seed;
+  layer->period_i = wrap ? wrap->w / divisor : 0;
+  layer->period_j = wrap ? wrap->h / divisor : 0;
+  layer->shift_i = wrap ? (wrap->shift - wrap->h / 2) / divisor : 0;
+}
+
+static struct gradient lattice_gradient(struct simplex_layer *layer, int i, int j)
+{
+  struct gradient g;
+  if (layer->period_j) {
+    int k = floor_div(j, layer->period_j);
+    j -= k * layer->period_j;
+    i -= k * layer->shift_i;
+  }
+  if (layer->period_i) {
+    i -= floor_div(i, layer->period_i) * layer->period_i;
+  }
+  const float *v = gradients[noise_hash(layer->seed, i, j) % 12];
+  g.x = v[0];
+  g.y = v[1];
+  return g;
+}
+
+static float contribution(struct gradient g, float dx, float dy)
+{
+  float t = RADIUS2 - dx * dx - dy * dy;
+  t = t > 0 ? t : 0;
+  t *= t;
+  return t * t * (g.x * dx + g.y * dy);
+}
+
+/* out[sub] for sub = from .. to - 1 inside one lattice cell and one
+ * triangle: the sum of the corners g[k] at (cx[k], cy[k]) for the sample
+ * at (sub * inv + px0, 0). the vector version does the same float
+ * operations in the same order, none of them contracted to an FMA. */
+static void simplex_span(struct gradient *g, const float *cx, const float *cy,
+    int from, int to, float inv, float px0, float *out)
+{
+  int sub = from;
+#if defined(__SSE2__)
+  __m128 zero = _mm_setzero_ps();
+  __m128 radius2 = _mm_set1_ps(RADIUS2);
+  __m128 scale = _mm_set1_ps(SCALE);
+  __m128 v_inv = _mm_set1_ps(inv);
+  __m128 v_px0 = _mm_set1_ps(px0);
+  for (; sub + 4 <= to; sub += 4) {
+    __m128i subs = _mm_add_epi32(_mm_set1_epi32(sub), _mm_set_epi32(3, 2, 1, 0));
+    __m128 px = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(subs), v_inv), v_px0);
+    __m128 sum = zero;
+    for (int k = 0; k < 3; ++k) {
+      __m128 dx = _mm_sub_ps(px, _mm_set1_ps(cx[k]));
+      __m128 dy = _mm_set1_ps(cy[k]);
+      __m128 t = _mm_sub_ps(_mm_sub_ps(radius2, _mm_mul_ps(dx, dx)),
+          _mm_mul_ps(dy, dy));
+      t = _mm_max_ps(t, zero);
+      t = _mm_mul_ps(t, t);
+      __m128 dot = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(g[k].x), dx),
+          _mm_mul_ps(_mm_set1_ps(g[k].y), dy));
+      __m128 c = _mm_mul_ps(_mm_mul_ps(t, t), dot);
+      sum = k ? _mm_add_ps(sum, c) : c;
+    }
+    _mm_storeu_ps(out + sub, _mm_mul_ps(sum, scale));
+  }
+#endif
+  for (; sub < to; ++sub) {
+    float px = sub * inv + px0;
+    out[sub] = (contribution(g[0], px - cx[0], cy[0])
+        + contribution(g[1], px - cx[1], cy[1])
+        + contribution(g[2], px - cx[2], cy[2])) * SCALE;
+  }
+}
+
+/* cells x0 .. x0 + w - 1 of offset row y. the row is walked one lattice
+ * cell at a time, inside a cell the gradients are fixed and the triangle
+ * only changes once, at sub_q + sub_r == divisor */
+static void simplex_layer_row(struct simplex_layer *layer, int x0, int y,
+    int w, float *out)
+{
+  int divisor = layer->divisor;
+  float inv = layer->inv_divisor;
+  struct map_ipos o_pos = {x0, y};
+  struct map_ipos m_pos;
+  offset_to_map_i(&o_pos, &m_pos);
+
+  int j = floor_div(m_pos.y, divisor);
+  int sub_r = m_pos.y - j * divisor;
+  float fr = sub_r * inv;
+  float px0 = fr * 0.5f;
+  float py = fr * SQRT3_2;
+  float py1 = py - SQRT3_2;
+  int i = floor_div(m_pos.x, divisor);
+  int sub_q = m_pos.x - i * divisor;
+  /* corners of the lower triangle (i, j), (i + 1, j), (i, j + 1) and of
+   * the upper one (i + 1, j + 1), (i + 1, j), (i, j + 1) */
+  const float lower_x[3] = {0.0f, 1.0f, 0.5f};
+  const float upper_x[3] = {1.5f, 1.0f, 0.5f};
+  const float lower_y[3] = {py, py, py1};
+  const float upper_y[3] = {py1, py, py1};
+  struct gradient g00 = lattice_gradient(layer, i, j);
+  struct gradient g01 = lattice_gradient(layer, i, j + 1);
+
+  for (int x = 0; x < w; ++i) {
+    struct gradient g10 = lattice_gradient(layer, i + 1, j);
+    struct gradient g11 = lattice_gradient(layer, i + 1, j + 1);
+    struct gradient lower[3] = {g00, g10, g01};
+    struct gradient upper[3] = {g11, g10, g01};
+    int end = sub_q + w - x < divisor ? sub_q + w - x : divisor;
+    int split = divisor - sub_r < end ? divisor - sub_r : end;
+    float *o = out + x - sub_q;
+    x += end - sub_q;
+    if (sub_q < split) {
+      simplex_span(lower, lower_x, lower_y, sub_q, split, inv, px0, o);
+      sub_q = split;
+    }
+    simplex_span(upper, upper_x, upper_y, sub_q, end, inv, px0, o);
+    sub_q = 0;
+    g00 = g10;
+    g01 = g11;
+  }
+}
+
+void simplex_noise2d_window(int divisor, unsigned int seed,
+    struct noise_wrap *wrap, int x0, int y0, int w, int h, float *out)
+{
+  struct simplex_layer layer;
+  simplex_layer_init(&layer, divisor, seed, wrap);
+  for (int y = 0; y < h; ++y) {
+    simplex_layer_row(&layer, x0, y0 + y, w, out + y * w);
+  }
+}
+
+void simplex_fbm2d_window(struct noise_octave *octaves, int n_octaves,
+    unsigned int seed, struct noise_wrap *wrap, int x0, int y0, int w, int h,
+    float *out)
+{
+  struct simplex_layer *layers = malloc(n_octaves * sizeof(*layers));
+  float *row = malloc(w * sizeof(*row));
+  for (int i = 0; i < n_octaves; ++i) {
+    simplex_layer_init(&layers[i], octaves[i].divisor, seed + i, wrap);
+  }
+  for (int y = 0; y < h; ++y) {
+    for (int i = 0; i < n_octaves; ++i) {
+      simplex_layer_row(&layers[i], x0, y0 + y, w, row);
+      noise_accumulate(out + y * w, row, w, octaves[i].weight, i > 0);
+    }
+  }
+  free(row);
+  free(layers);
+}
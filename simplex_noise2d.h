@@ -0,0 +1,20 @@
+#ifndef SIMPLEX_NOISE2D_H
+#define SIMPLEX_NOISE2D_H
+
+#include "noise.h"
+
+/* simplex noise evaluated at hex cell centers. the hex grid already is a
+ * triangular lattice, so the simplex lattice is every divisor-th cell in
+ * map (axial) coordinates and each sample sums the three corners of the
+ * triangle around it. window and wrap are in offset coordinates like the
+ * perlin versions, output is roughly in -1 .. 1.
+ *
+ * the lattice follows wrap if w, h and shift are multiples of every
+ * divisor, h is even and h / 2 is a multiple of every divisor as well. */
+void simplex_noise2d_window(int divisor, unsigned int seed,
+    struct noise_wrap *wrap, int x0, int y0, int w, int h, float *out);
+void simplex_fbm2d_window(struct noise_octave *octaves, int n_octaves,
+    unsigned int seed, struct noise_wrap *wrap, int x0, int y0, int w, int h,
+    float *out);
+
+#endif
@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "jobs.h"
+#include "perlin_noise2d.h"
+#include "worldgen.h"
+
+/* bands of rows are handed out to the jobs pool. the exact mode makes two
+ * passes: the first one writes the noise and the smallest and biggest
+ * value of each band, the second one classifies with the merged
+ * extremes. the sampled mode estimates the extremes from every
+ * sample_step-th row first and then classifies each band right after
+ * computing its noise. the percentile mode counts the sampled rows into
+ * a histogram per band the same way, the merged histogram maps bins to
+ * tiles and each band is then classified right after computing its
+ * noise. every pixel is computed the same way whichever thread gets its
+ * band, so the output does not depend on scheduling. */
+struct worldgen_ctx {
+  struct mmap *map;
+  struct worldgen_params *params;
+  struct noise_wrap *wrap;
+  int bands;
+  float *noise;
+  float *band_min;
+  float *band_max;
+  float smalest;
+  float biggest;
+  /* limits converted to raw noise values, see raw_limits() */
+  float *raw;
+  /* percentile mode: one histogram per band and the tile of every bin */
+  unsigned int *histograms;
+  unsigned char *bin_tiles;
+  float range;
+  /* the job of the current pass, see run_pass() */
+  job_cb pass;
+};
+
+static void band_rows(struct worldgen_ctx *ctx, int band, int *y_start, int *y_end)
+{
+  *y_start = band * WORLDGEN_BAND_ROWS;
+  *y_end = *y_start + WORLDGEN_BAND_ROWS;
+  if (*y_end > ctx->map->h) {
+    *y_end = ctx->map->h;
+  }
+}
+
+/* rows y_start .. y_end - 1 of the noise map */
+static void band_noise(struct worldgen_ctx *ctx, int y_start, int y_end,
+    float *noise)
+{
+  struct noise_params *params = ctx->params->noise;
+  int w = ctx->map->w;
+  if (!ctx->wrap && params->type == NOISE_PERLIN) {
+    perlin_fbm2d_rows(w, ctx->map->h, params->octaves, params->n_octaves,
+        params->seed, y_start, y_end, noise);
+  } else {
+    noise_window(params, ctx->wrap, 0, y_start, w, y_end - y_start, noise);
+  }
+}
+
+static void min_max(float *noise, int n, float *smalest, float *biggest)
+{
+  for (int p = 0; p < n; ++p) {
+    if (noise[p] < *smalest) {
+      *smalest = noise[p];
+    } else if (noise[p] > *biggest) {
+      *biggest = noise[p];
+    }
+  }
+}
+
+static void noise_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  int w = ctx->map->w;
+  int y_start;
+  int y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  float *noise = ctx->noise + y_start * w;
+  band_noise(ctx, y_start, y_end, noise);
+  ctx->band_min[band] = 0;
+  ctx->band_max[band] = 0;
+  min_max(noise, (y_end - y_start) * w, &ctx->band_min[band],
+      &ctx->band_max[band]);
+}
+
+static void classify_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  const double *limits = ctx->params->limits;
+  int n_limits = ctx->params->n_limits;
+  int w = ctx->map->w;
+  int y_start;
+  int y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  for (int y = y_start; y < y_end; ++y) {
+    float *noise = ctx->noise + y * w;
+    for (int x = 0; x < w; ++x) {
+      float v = noise[x];
+      if (v < 0.0) {
+        v /= ctx->smalest;
+      } else {
+        v /= ctx->biggest;
+      }
+      float n = (v + 1.0) / 2.0;
+      int tile = 0;
+      while (tile < n_limits && n >= limits[tile]) {
+        ++tile;
+      }
+      mmap_set(ctx->map, x, y, tile);
+    }
+  }
+}
+
+static void sample_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  int step = ctx->params->sample_step;
+  int w = ctx->map->w;
+  int y_start;
+  int y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  float *noise = malloc(w * sizeof(*noise));
+  ctx->band_min[band] = 0;
+  ctx->band_max[band] = 0;
+  for (int y = (y_start + step - 1) / step * step; y < y_end; y += step) {
+    band_noise(ctx, y, y + 1, noise);
+    min_max(noise, w, &ctx->band_min[band], &ctx->band_max[band]);
+  }
+  free(noise);
+}
+
+/* n = (v / bound + 1) / 2 >= limit turned around for v, bound being the
+ * smallest value for limits below .5 and the biggest one above */
+static void raw_limits(struct worldgen_ctx *ctx)
+{
+  for (int i = 0; i < ctx->params->n_limits; ++i) {
+    double l = ctx->params->limits[i] * 2 - 1;
+    ctx->raw[i] = l * (l < 0 ? ctx->smalest : ctx->biggest);
+  }
+}
+
+/* tile ids of n noise values, the number of raw limits each one reaches */
+static void classify_row(const float *noise, int n, const float *raw,
+    int n_raw, unsigned char *tiles)
+{
+  for (int x = 0; x < n; ++x) {
+    tiles[x] = 0;
+  }
+  for (int i = 0; i < n_raw; ++i) {
+    for (int x = 0; x < n; ++x) {
+      tiles[x] += noise[x] >= raw[i];
+    }
+  }
+}
+
+static void direct_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  int w = ctx->map->w;
+  int y_start;
+  int y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  float *noise = malloc((y_end - y_start) * w * sizeof(*noise));
+  unsigned char *tiles = malloc(w);
+  band_noise(ctx, y_start, y_end, noise);
+  for (int y = y_start; y < y_end; ++y) {
+    classify_row(noise + (y - y_start) * w, w, ctx->raw,
+        ctx->params->n_limits, tiles);
+    for (int x = 0; x < w; ++x) {
+      mmap_set(ctx->map, x, y, tiles[x]);
+    }
+  }
+  free(tiles);
+  free(noise);
+}
+
+/* bin of a noise value, values outside -range .. range go to the first
+ * and last bin. that only matters if a percentile falls there. */
+static int noise_bin(float v, float range)
+{
+  int bin = (v / range + 1) * (WORLDGEN_BINS / 2);
+  if (bin < 0) {
+    return 0;
+  }
+  return bin < WORLDGEN_BINS ? bin : WORLDGEN_BINS - 1;
+}
+
+/* counts every sample_step-th row, every row with sample_step 0 */
+static void histogram_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  int step = ctx->params->sample_step > 0 ? ctx->params->sample_step : 1;
+  int w = ctx->map->w;
+  int y_start;
+  int y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  float *noise = malloc(w * sizeof(*noise));
+  unsigned int *histogram = ctx->histograms + band * WORLDGEN_BINS;
+  for (int b = 0; b < WORLDGEN_BINS; ++b) {
+    histogram[b] = 0;
+  }
+  for (int y = (y_start + step - 1) / step * step; y < y_end; y += step) {
+    band_noise(ctx, y, y + 1, noise);
+    for (int x = 0; x < w; ++x) {
+      histogram[noise_bin(noise[x], ctx->range)]++;
+    }
+  }
+  free(noise);
+}
+
+/* merges the band histograms and gives every bin the tile of the
+ * fraction of counted cells below it */
+static void percentile_tiles(struct worldgen_ctx *ctx)
+{
+  const double *limits = ctx->params->limits;
+  int n_limits = ctx->params->n_limits;
+  double cells = 0;
+  unsigned long long below = 0;
+  int tile = 0;
+  for (int i = 0; i < ctx->bands * WORLDGEN_BINS; ++i) {
+    cells += ctx->histograms[i];
+  }
+  for (int b = 0; b < WORLDGEN_BINS; ++b) {
+    while (tile < n_limits && below >= limits[tile] * cells) {
+      ++tile;
+    }
+    ctx->bin_tiles[b] = tile;
+    for (int i = 0; i < ctx->bands; ++i) {
+      below += ctx->histograms[i * WORLDGEN_BINS + b];
+    }
+  }
+}
+
+static void bin_tiles_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  int w = ctx->map->w;
+  int y_start;
+  int y_end;
+  band_rows(ctx, band, &y_start, &y_end);
+  float *noise = malloc((y_end - y_start) * w * sizeof(*noise));
+  band_noise(ctx, y_start, y_end, noise);
+  for (int y = y_start; y < y_end; ++y) {
+    float *row = noise + (y - y_start) * w;
+    for (int x = 0; x < w; ++x) {
+      mmap_set(ctx->map, x, y, ctx->bin_tiles[noise_bin(row[x], ctx->range)]);
+    }
+  }
+  free(noise);
+}
+
+/* noise of the engines stays within about -1 .. 1 per octave */
+static float noise_range(struct noise_params *params)
+{
+  double range = 0;
+  for (int i = 0; i < params->n_octaves; ++i) {
+    range += fabs(params->octaves[i].weight);
+  }
+  return range;
+}
+
+static int cancelled(struct worldgen_ctx *ctx)
+{
+  struct worldgen_status *status = ctx->params->status;
+  return status && atomic_load_explicit(&status->cancel, memory_order_relaxed);
+}
+
+static void pass_job(void *data, int band)
+{
+  struct worldgen_ctx *ctx = data;
+  if (cancelled(ctx)) {
+    return;
+  }
+  ctx->pass(ctx, band);
+  if (ctx->params->status) {
+    atomic_fetch_add(&ctx->params->status->done, 1);
+  }
+}
+
+/* every mode makes two passes over the bands, once cancelled the
+ * remaining bands are skipped. the first pass is then incomplete and
+ * the second one must not run on what it left. */
+static void run_pass(struct worldgen_ctx *ctx, int threads, job_cb cb)
+{
+  ctx->pass = cb;
+  jobs_run(threads, ctx->bands, pass_job, ctx);
+}
+
+float worldgen_progress(struct worldgen_status *status)
+{
+  int total = atomic_load(&status->total);
+  return total ? (float)atomic_load(&status->done) / total : 0;
+}
+
+static void merge_bounds(struct worldgen_ctx *ctx)
+{
+  ctx->smalest = 0;
+  ctx->biggest = 0;
+  for (int i = 0; i < ctx->bands; ++i) {
+    if (ctx->band_min[i] < ctx->smalest) {
+      ctx->smalest = ctx->band_min[i];
+    }
+    if (ctx->band_max[i] > ctx->biggest) {
+      ctx->biggest = ctx->band_max[i];
+    }
+  }
+  ctx->smalest = fabs(ctx->smalest);
+}
+
+int worldgen_generate(struct mmap *map, struct worldgen_params *params,
+    int threads)
+{
+  struct worldgen_ctx ctx;
+  /* the noise is sampled in offset coordinates, there the map is a torus
+   * if its height is even */
+  struct noise_wrap wrap = {map->w, map->h, 0};
+  ctx.map = map;
+  ctx.params = params;
+  ctx.wrap = map->h % 2 == 0 && noise_wraps(params->noise, &wrap) ? &wrap : NULL;
+  ctx.bands = (map->h + WORLDGEN_BAND_ROWS - 1) / WORLDGEN_BAND_ROWS;
+  ctx.band_min = malloc(2 * ctx.bands * sizeof(*ctx.band_min));
+  ctx.band_max = ctx.band_min + ctx.bands;
+  if (params->status) {
+    atomic_store(&params->status->done, 0);
+    atomic_store(&params->status->total, 2 * ctx.bands);
+  }
+
+  if (params->percentiles) {
+    ctx.range = noise_range(params->noise);
+    ctx.histograms = malloc(ctx.bands * WORLDGEN_BINS * sizeof(*ctx.histograms));
+    ctx.bin_tiles = malloc(WORLDGEN_BINS);
+    run_pass(&ctx, threads, histogram_job);
+    if (!cancelled(&ctx)) {
+      percentile_tiles(&ctx);
+      run_pass(&ctx, threads, bin_tiles_job);
+    }
+    free(ctx.bin_tiles);
+    free(ctx.histograms);
+  } else if (params->sample_step > 0) {
+    ctx.raw = malloc(params->n_limits * sizeof(*ctx.raw));
+    run_pass(&ctx, threads, sample_job);
+    if (!cancelled(&ctx)) {
+      merge_bounds(&ctx);
+      raw_limits(&ctx);
+      run_pass(&ctx, threads, direct_job);
+    }
+    free(ctx.raw);
+  } else {
+    ctx.noise = malloc(map->w * map->h * sizeof(*ctx.noise));
+    run_pass(&ctx, threads, noise_job);
+    if (!cancelled(&ctx)) {
+      merge_bounds(&ctx);
+      run_pass(&ctx, threads, classify_job);
+    }
+    free(ctx.noise);
+  }
+  free(ctx.band_min);
+  if (cancelled(&ctx)) {
+    return -1;
+  }
+  /* drops the tiles of an earlier map from the chunk palettes */
+  mmap_compact(map);
+  return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef WORLDGEN_H
+#define WORLDGEN_H
+
+#include <stdatomic.h>
+#include "mmap.h"
+#include "noise.h"
+
+/* rows per job, the map is generated in bands of this many rows. a
+ * multiple of MMAP_CHUNK, so no two bands write to the same chunk. */
+#define WORLDGEN_BAND_ROWS 64
+/* histogram resolution of the percentile mode */
+#define WORLDGEN_BINS 4096
+
+/* progress of a worldgen_generate() call for other threads: done of
+ * total jobs are finished. setting cancel makes the remaining jobs return
+ * right away. */
+struct worldgen_status {
+  atomic_int done;
+  atomic_int total;
+  atomic_int cancel;
+};
+
+/* noise is normalized to -1 .. 1 by the smallest and biggest value and
+ * mapped to n = (noise + 1) / 2. a cell gets tile i if n is below
+ * limits[i] (and not below any earlier one) and tile n_limits if n is
+ * not below any of them, limits ascending.
+ *
+ * with sample_step 0 the extremes are exact, which needs all of the
+ * noise in a float buffer and a second pass over it. with sample_step
+ * n they are estimated from every n-th row and each band of rows is
+ * classified into tile ids right after its noise is computed: no full
+ * size buffer and no second pass, the sampled rows cost about 1 / n of
+ * the noise. cells close to a limit may get the neighbouring tile.
+ *
+ * with percentiles set the limits are fractions of the map instead:
+ * {.6, .9} makes 60% of the cells tile 0, 30% tile 1 and 10% tile 2,
+ * whatever the seed. the noise is counted into a histogram of
+ * WORLDGEN_BINS bins per band, of every row with sample_step 0 and of
+ * every n-th row with sample_step n. the merged histogram gives every
+ * bin its tile and each band is classified right after computing its
+ * noise, so besides one band of noise per thread this only needs
+ * WORLDGEN_BINS counters per band. counting every row meets the
+ * fractions to within one bin, but with sample_step 0 all of the noise
+ * is computed twice, the slowest of all modes. sample_step n only adds
+ * about 1 / n and estimates the fractions, 8 is plenty for tiles. */
+struct worldgen_params {
+  struct noise_params *noise;
+  const double *limits;
+  int n_limits;
+  int sample_step;
+  int percentiles;
+  /* optional, see struct worldgen_status */
+  struct worldgen_status *status;
+};
+
+/* fills the whole map (map->w * map->h, already initialized) with tiles
+ * from fractal noise of any engine. the result only depends on the map
+ * size and the parameters, not on the number of threads.
+ *
+ * if the map height is even and the lattice fits the map, see
+ * noise_wraps(), the noise wraps with the map and has no seams at its
+ * edges.
+ *
+ * returns 0, or -1 if params->status was cancelled. the map is left half
+ * done then. */
+int worldgen_generate(struct mmap *map, struct worldgen_params *params,
+    int threads);
+/* done / total of status, 0 before it started */
+float worldgen_progress(struct worldgen_status *status);
+
+#endif